@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -17,7 +18,9 @@
 #define TOGGLE_FLAG(var, flag) ((var) ^= (flag))
 #define HAS_FLAG(var, flag) (((var) & (flag)) != 0)
 
-#define FILE_TO_WORK_ON "Demo.obj"
+#define FILE_TO_WORK_ON "Demo.tmap"
+// Text copy of the map, written on demand and read when there is no map yet.
+#define OBJ_FILE_TO_EXPORT "Demo.obj"
 #define OUTPUT_LOG_STREAM stderr
 
 #define REDDISH 255, 128, 128
@@ -33,6 +36,29 @@
 #define FRAME_DELAY (1000 / MAX_FPS)
 #define INPUT_DELAY 75
 
+// Bytes of undo history kept, the oldest steps are dropped past this.
+#define EDIT_HISTORY_BUDGET (4 * 1024 * 1024)
+// Fills reaching past this many tiles are refused, the canvas is unbounded.
+#define FLOOD_FILL_MAX_AREA (1024 * 1024)
+// Layers every map starts with, bottom first. Files may add more.
+#define DEFAULT_TILE_LAYERS {"ground", "decoration", "collision"}
+
+// Tools are picked with these keys while no widget is being edited.
+#define PEN_TOOL_KEY '1'
+#define FILL_TOOL_KEY '2'
+#define RECT_FILL_TOOL_KEY '3'
+#define RECT_ERASE_TOOL_KEY '4'
+#define SELECT_TOOL_KEY '5'
+#define REPLACE_TOOL_KEY '6'
+#define ROTATE_CLIPBOARD_KEY 'r'
+#define FLIP_CLIPBOARD_X_KEY 'h'
+#define FLIP_CLIPBOARD_Y_KEY 'v'
+#define NEXT_LAYER_KEY ']'
+#define PREVIOUS_LAYER_KEY '['
+#define TOGGLE_LAYER_KEY 'l' // Hides or shows the active layer.
+// Clipboard cells written per frame by a paste.
+#define PASTE_TILES_PER_FRAME (256 * 1024)
+
 #define GRID_DELTA_SIZE 2
 #define GRID_ZOOM_OUT_LIMIT 10
 #define GRID_ZOOM_IN_LIMIT 200
@@ -58,3 +84,61 @@ typedef enum Enum_StatusCodes {
 extern void Logger(Enum_StatusCodes *pStatus_codes,
                    const char *(*extra_logs_callback)(void), const char *logs,
                    FILE *output_stream);
+
+/*
+Maps a whole file read only, so loaders scan it in place with no copies or
+read calls. An empty file maps to a NULL pData and a size of 0.
+*/
+extern Enum_StatusCodes MapFile(const char *file_path, const void **pData,
+                                size_t *pSize);
+extern void UnmapFile(const void *data, size_t size);
+// Cores available to worker threads, at least 1.
+extern uint32_t GetProcessorCount(void);
+
+/*
+Text output gathered in a large buffer and handed to the file in big write
+calls, with integers formatted by FormatDecimal, so exports are not held back
+by stdio format parsing. The first failure sticks, writers are driven without
+checking each call and the outcome is read once from CloseTextWriter.
+*/
+typedef struct Struct_TextWriter {
+  int32_t fd;
+  char *buffer;
+  size_t size, capacity;
+  Enum_StatusCodes status;
+} Struct_TextWriter;
+
+extern Enum_StatusCodes OpenTextWriter(const char *file_path,
+                                       Struct_TextWriter *pWriter);
+// Flushes what is left and closes the file, returning the first failure.
+extern Enum_StatusCodes CloseTextWriter(Struct_TextWriter *pWriter);
+/*
+Room for at least size more bytes at the end of the buffer, flushing it first
+when needed. NULL once the writer has failed. Whatever is written there counts
+once CommitText is called with the end of it.
+*/
+extern char *ReserveText(Struct_TextWriter *pWriter, size_t size);
+extern void CommitText(Struct_TextWriter *pWriter, const char *end);
+extern void WriteText(Struct_TextWriter *pWriter, const char *text,
+                      size_t length);
+// Writes value as printf's %d would, without a terminator, returns the end.
+extern char *FormatDecimal(char *dest, int64_t value);
+
+/*
+Binary files are read in place out of a mapping through a cursor, every read
+checked against the end of the mapping so a truncated or corrupt file fails
+instead of reading past it. Each value or array written is padded to
+BINARY_ALIGNMENT, which keeps whatever follows aligned for reading in place.
+*/
+#define BINARY_ALIGNMENT 4
+#define BINARY_ALIGN(size)                                                     \
+  (((size) + BINARY_ALIGNMENT - 1) & ~(size_t)(BINARY_ALIGNMENT - 1))
+
+extern Enum_StatusCodes WriteBinary(const void *data, size_t size,
+                                    FILE *file);
+// Points pData at the next size bytes without copying them.
+extern Enum_StatusCodes MapBinary(const void **pData, size_t size,
+                                  const uint8_t **pCursor, const uint8_t *end);
+extern Enum_StatusCodes ReadBinary(void *pDest, size_t size,
+                                   const uint8_t **pCursor,
+                                   const uint8_t *end);
\ No newline at end of file
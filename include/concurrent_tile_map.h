@@ -0,0 +1,62 @@
+#pragma once
+
+#include "../include/tile_map_manager.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define CONCURRENT_TILE_MAP_SHARDS 16
+
+/*
+Shards use the Left-Right technique, each holds two copies of its tiles.
+Readers only ever touch the copy no writer is working on, so they never block
+or retry and never see a half done resize. Writers update the other copy, flip
+readers over to it, wait for readers still on the old copy to leave and then
+replay the same change on it. The price is every tile being stored twice.
+*/
+typedef struct Struct_TileMapShard {
+  _Alignas(64) atomic_uint readers[2]; // Own cache line, readers hammer these.
+  atomic_uint version_index;           // Which readers counter new readers use.
+  atomic_uint read_instance;           // Which copy readers should use.
+  Struct_TileHashMap instances[2];
+  pthread_mutex_t write_lock;
+} Struct_TileMapShard;
+
+/*
+Writers are sharded by chunk, so edits in different parts of the map go ahead
+in parallel and a chunk never straddles two shards. Variants of tiles on a
+chunk edge are worked out on read from the shards holding their neighbours,
+so next to a write in progress they may be a write behind. The editor itself
+keeps working on plain maps from its one thread, this is for code that needs
+to share a map between threads.
+*/
+typedef struct Struct_ConcurrentTileMap {
+  Struct_TileMapShard shards[CONCURRENT_TILE_MAP_SHARDS];
+} Struct_ConcurrentTileMap;
+
+extern Enum_StatusCodes
+InitConcurrentTileMap(Struct_ConcurrentTileMap *pConcurrent_tile_map);
+extern void
+FreeConcurrentTileMap(Struct_ConcurrentTileMap *pConcurrent_tile_map);
+extern Enum_StatusCodes
+AddConcurrentTileMapEntry(int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b,
+                          Struct_ConcurrentTileMap *pConcurrent_tile_map);
+extern Enum_StatusCodes
+PopConcurrentTileMapEntry(int32_t x, int32_t y,
+                          Struct_ConcurrentTileMap *pConcurrent_tile_map);
+extern Enum_StatusCodes
+AccessConcurrentTileMap(int32_t x, int32_t y,
+                        Struct_ConcurrentTileMap *pConcurrent_tile_map,
+                        Struct_TileHashNode *pDest);
+/*
+Calls callback for every occupied tile inside the inclusive rectangle. Each
+shard is walked inside its own read section, so writers to a shard wait for
+the walk of that shard to finish but never the other way round. That includes
+the callback itself, it must not add or pop tiles on this map, a write landing
+on the shard being walked would wait on its own read section forever. Gather
+the tiles and edit after the walk instead.
+*/
+extern void ForEachConcurrentTileInRange(
+    int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y,
+    Struct_ConcurrentTileMap *pConcurrent_tile_map,
+    void (*callback)(const Struct_TileHashNode *pTile, void *pUser_data),
+    void *pUser_data);
\ No newline at end of file
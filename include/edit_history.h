@@ -0,0 +1,79 @@
+#pragma once
+
+#include "../include/tile_map_manager.h"
+
+// High bit of Struct_EditDelta.run, set on the first delta of an undo step.
+#define EDIT_DELTA_GROUP_START 0x80000000U
+// Set on both deltas of a colour remap.
+#define EDIT_DELTA_REMAP 0x40000000U
+#define EDIT_DELTA_RUN_MASK 0x3FFFFFFFU
+
+/*
+A horizontal run of tiles that all went from old_value to new_value, so a
+stroke along a row costs one delta instead of one per tile. A colour replace
+is a pair of EDIT_DELTA_REMAP deltas instead, holding the top left and bottom
+right of its region, and is undone and redone by replacing the colour again.
+*/
+typedef struct Struct_EditDelta {
+  int32_t x, y; // Leftmost tile of the run.
+  uint32_t run; // Run length in the low bits, the flags on top.
+  uint32_t old_value, new_value;
+} Struct_EditDelta;
+
+/*
+Undo log kept in a fixed size ring, sized once from a memory budget. Deltas in
+[head, head + applied) can be undone, the ones after that up to count can be
+redone. Once the ring is full the oldest undo steps are dropped whole, so
+recording, undoing and redoing all cost O(delta) no matter how long the session
+has been running.
+*/
+typedef struct Struct_EditHistory {
+  Struct_EditDelta *deltas;
+  uint32_t capacity;
+  uint32_t head;
+  uint32_t applied;
+  uint32_t count;
+  uint32_t groups; // Undo steps in [head, head + applied).
+  uint8_t group_pending; // Next delta starts a new undo step.
+  uint8_t group_dropped; // Current step outgrew the ring and is not recorded.
+} Struct_EditHistory;
+
+extern uint32_t GetTileValue(int32_t x, int32_t y,
+                             const Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes InitEditHistory(Struct_EditHistory *pEdit_history,
+                                        size_t memory_budget);
+extern void FreeEditHistory(Struct_EditHistory *pEdit_history);
+/*
+Everything recorded until the next call is undone and redone as one step, like
+a whole stroke or fill.
+*/
+extern void BeginEditGroup(Struct_EditHistory *pEdit_history);
+/*
+An undo step that is also a single map transaction, for edits done in one go.
+Edits spread over several frames, like strokes, group the history instead.
+*/
+extern void BeginEditTransaction(Struct_EditHistory *pEdit_history,
+                                 Struct_TileHashMap *pTile_hash_map);
+extern void CommitEditTransaction(Struct_EditHistory *pEdit_history,
+                                  Struct_TileHashMap *pTile_hash_map);
+extern void RecordTileEdit(int32_t x, int32_t y, uint32_t old_value,
+                           uint32_t new_value,
+                           Struct_EditHistory *pEdit_history);
+// Same as RecordTileEdit for length tiles rightwards of (x, y).
+extern void RecordTileRunEdit(int32_t x, int32_t y, uint32_t length,
+                              uint32_t old_value, uint32_t new_value,
+                              Struct_EditHistory *pEdit_history);
+/*
+Recolours like ReplaceTileHashMapColor, recorded as one remap no matter how
+many tiles change. Tiles of the region already holding the new colour are
+recorded too, a run each, so undoing leaves them be.
+*/
+extern Enum_StatusCodes ReplaceColorWithHistory(
+    uint8_t from_r, uint8_t from_g, uint8_t from_b, uint8_t to_r, uint8_t to_g,
+    uint8_t to_b, const Struct_TileBounds *pRegion,
+    Struct_EditHistory *pEdit_history, Struct_TileHashMap *pTile_hash_map);
+// FAILURE when there is nothing to undo or redo.
+extern Enum_StatusCodes UndoEdit(Struct_EditHistory *pEdit_history,
+                                 Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes RedoEdit(Struct_EditHistory *pEdit_history,
+                                 Struct_TileHashMap *pTile_hash_map);
\ No newline at end of file
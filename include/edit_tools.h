@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../include/edit_history.h"
+
+typedef enum Enum_Tools {
+  PEN_TOOL,
+  FILL_TOOL,
+  RECT_FILL_TOOL,
+  RECT_ERASE_TOOL,
+  SELECT_TOOL,
+  REPLACE_TOOL
+} Enum_Tools;
+
+/*
+Tiles painted, or erased, while the mouse button is held. Successive samples
+are joined with Bresenham lines so fast motion leaves no gaps, and the tiles
+are queued and written to the map in batches instead of once per event.
+*/
+typedef struct Struct_Stroke {
+  uint8_t active;
+  uint8_t erasing; // Decided by whether the first tile was occupied.
+  uint8_t r, g, b;
+  int32_t last_x, last_y;
+  Struct_TileHashNode *pending;
+  uint32_t pending_count, pending_capacity;
+} Struct_Stroke;
+
+// Rectangle dragged out from where the mouse was pressed to where it is now.
+typedef struct Struct_RectDrag {
+  uint8_t active;
+  int32_t anchor_x, anchor_y;
+  int32_t corner_x, corner_y;
+} Struct_RectDrag;
+
+// Copied region as row major TILE_VALUEs, width * height of them.
+typedef struct Struct_TileClipboard {
+  uint32_t width, height;
+  uint32_t *values;
+} Struct_TileClipboard;
+
+/*
+Paste in progress. A few clipboard rows are written per frame so large pastes
+never stall one, the whole paste still being a single undo step.
+*/
+typedef struct Struct_PasteJob {
+  uint8_t active;
+  int32_t x, y;          // Where the top left of the clipboard lands.
+  uint32_t next_row;     // First clipboard row not written yet.
+  uint32_t *old_values;  // Rows about to be replaced, for the history.
+  uint32_t old_capacity; // In values.
+} Struct_PasteJob;
+
+typedef struct Struct_ToolState {
+  Enum_Tools active_tool;
+  Struct_Stroke stroke;
+  Struct_RectDrag rect;
+  uint8_t has_selection;
+  Struct_TileBounds selection;
+  Struct_TileClipboard clipboard;
+  Struct_PasteJob paste;
+} Struct_ToolState;
+
+// Inclusive run of tiles on one row.
+typedef struct Struct_TileSpan {
+  int32_t y, min_x, max_x;
+} Struct_TileSpan;
+
+// Starts a stroke as its own undo step, nothing is written until a flush.
+extern Enum_StatusCodes BeginStroke(int32_t x, int32_t y, uint8_t r, uint8_t g,
+                                    uint8_t b, Struct_Stroke *pStroke,
+                                    Struct_EditHistory *pEdit_history,
+                                    const Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes ExtendStroke(int32_t x, int32_t y,
+                                     Struct_Stroke *pStroke);
+// Writes the queued tiles as one batch.
+extern Enum_StatusCodes FlushStroke(Struct_Stroke *pStroke,
+                                    Struct_EditHistory *pEdit_history,
+                                    Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes EndStroke(Struct_Stroke *pStroke,
+                                  Struct_EditHistory *pEdit_history,
+                                  Struct_TileHashMap *pTile_hash_map);
+extern void FreeStroke(Struct_Stroke *pStroke);
+/*
+Scanline flood fill, recolours the 4-connected region of tiles sharing the
+value of (x, y), empty cells included. The region is gathered a row span at a
+time before anything is written, so a region larger than max_area (an empty
+cell on an open canvas is unbounded) returns FAILURE without touching the map.
+The fill is recorded as a single undo step.
+*/
+extern Enum_StatusCodes FloodFillTiles(int32_t x, int32_t y, uint8_t r,
+                                       uint8_t g, uint8_t b, uint32_t max_area,
+                                       Struct_EditHistory *pEdit_history,
+                                       Struct_TileHashMap *pTile_hash_map);
+/*
+Fills, or with erasing set clears, the rectangle between two opposite corners
+given in any order, as a single undo step. The map is written a chunk row at a
+time and the history gets one run per row of unchanged old values.
+*/
+extern Enum_StatusCodes EditTileRect(int32_t x0, int32_t y0, int32_t x1,
+                                     int32_t y1, uint8_t erasing, uint8_t r,
+                                     uint8_t g, uint8_t b,
+                                     Struct_EditHistory *pEdit_history,
+                                     Struct_TileHashMap *pTile_hash_map);
+/*
+Recolours every tile sharing the colour of the tile at (x, y) inside pRegion,
+or across the whole map when it is NULL, as a single undo step.
+*/
+extern Enum_StatusCodes ReplaceTileColor(int32_t x, int32_t y, uint8_t r,
+                                         uint8_t g, uint8_t b,
+                                         const Struct_TileBounds *pRegion,
+                                         Struct_EditHistory *pEdit_history,
+                                         Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes
+CopyTileRegion(const Struct_TileBounds *pRegion,
+               const Struct_TileHashMap *pTile_hash_map,
+               Struct_TileClipboard *pClipboard);
+// Turns the clipboard a quarter turn clockwise.
+extern Enum_StatusCodes RotateTileClipboard(Struct_TileClipboard *pClipboard);
+// Mirrors the clipboard left to right, or top to bottom with vertical set.
+extern void FlipTileClipboard(uint8_t vertical,
+                              Struct_TileClipboard *pClipboard);
+extern void FreeTileClipboard(Struct_TileClipboard *pClipboard);
+/*
+Starts pasting the clipboard with its top left at (x, y). The clipboard must
+not change until the job is done, StepPaste with a budget of UINT32_MAX
+finishes it right away.
+*/
+extern Enum_StatusCodes BeginPaste(int32_t x, int32_t y,
+                                   const Struct_TileClipboard *pClipboard,
+                                   Struct_PasteJob *pPaste_job,
+                                   Struct_EditHistory *pEdit_history);
+// Writes whole clipboard rows until about tile_budget cells are done.
+extern Enum_StatusCodes StepPaste(uint32_t tile_budget,
+                                  const Struct_TileClipboard *pClipboard,
+                                  Struct_PasteJob *pPaste_job,
+                                  Struct_EditHistory *pEdit_history,
+                                  Struct_TileHashMap *pTile_hash_map);
+extern void FreePasteJob(Struct_PasteJob *pPaste_job);
\ No newline at end of file
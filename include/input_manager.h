@@ -14,7 +14,15 @@ typedef enum Enum_Inputs {
   QUIT = 1 << 6,
   MSB = 1 << 7,
   SCROLL_UP = 1 << 8,
-  SCROLL_DOWN = 1 << 9
+  SCROLL_DOWN = 1 << 9,
+  UNDO = 1 << 10,
+  REDO = 1 << 11,
+  MOUSE_DRAG = 1 << 12, // Moved with the left button held.
+  MSB_RELEASE = 1 << 13,
+  COPY = 1 << 14,
+  CUT = 1 << 15,
+  PASTE = 1 << 16,
+  EXPORT = 1 << 17 // Writes the OBJ copy of the map.
 } Enum_Inputs;
 
 extern Enum_Inputs GetInput(uint32_t *pRecorded_mouse_click_x,
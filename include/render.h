@@ -1,8 +1,9 @@
 #pragma once
 
 #include "../include/gfx.h"
-#include "../include/tile_map_manager.h"
+#include "../include/tile_layers.h"
 
-extern void Render(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
+extern void Render(SDL_Renderer *renderer,
+                   const Struct_TileLayerState *pTile_layer_state,
                    const Struct_InputWidgetState *pInput_widget_state,
                    int32_t move_x_offset, int32_t move_y_offset);
\ No newline at end of file
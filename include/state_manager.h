@@ -1,12 +1,14 @@
 #pragma once
 
+#include "../include/edit_tools.h"
 #include "../include/gfx.h"
 #include "../include/input_manager.h"
-#include "../include/tile_map_manager.h"
+#include "../include/tile_layers.h"
 
 extern void
-HandleState(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
+HandleState(SDL_Renderer *renderer, Struct_TileLayerState *pTile_layer_state,
             Struct_InputWidgetState *pInput_widget_state,
-            Enum_Inputs input_flags, int32_t *pMove_x_offset,
-            int32_t *pMove_y_offset, uint32_t *pRecorded_mouse_click_x,
+            Struct_ToolState *pTool_state, Enum_Inputs input_flags,
+            int32_t *pMove_x_offset, int32_t *pMove_y_offset,
+            uint32_t *pRecorded_mouse_click_x,
             uint32_t *pRecorded_mouse_click_y, uint32_t *pCurrent_time);
\ No newline at end of file
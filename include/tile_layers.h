@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../include/edit_history.h"
+#include "../include/tile_properties.h"
+
+#define MAX_TILE_LAYERS 8
+#define TILE_LAYER_NAME_LIMIT 32
+
+#define TILE_LAYERS_BINARY_MAGIC "TMAP"
+// Bumped on any change to the layout, older versions are refused.
+#define TILE_LAYERS_BINARY_VERSION 1
+// Written as a native word, it only reads back on a machine of the same order.
+#define TILE_LAYERS_BINARY_BYTE_ORDER 0x01020304U
+
+/*
+Each layer is a map of its own with its own undo history, so edits, undo and
+every per map structure stay exactly as they are and only ever see one layer.
+*/
+typedef struct Struct_TileLayer {
+  char name[TILE_LAYER_NAME_LIMIT];
+  uint8_t visible;
+  Struct_TileHashMap tile_hash_map;
+  Struct_EditHistory edit_history;
+  Struct_TilePropertyTable properties;
+} Struct_TileLayer;
+
+typedef struct Struct_TileLayersBinaryHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t tile_size; // What the OBJ export scales tiles by.
+  uint32_t layer_count;
+  uint32_t tile_count; // Across every layer.
+} Struct_TileLayersBinaryHeader;
+
+/*
+Layers are drawn in order, the first one at the bottom. Edits go to the active
+one. A layer that is hidden or has no tiles costs a flag check per frame, and
+a visible one only the chunks and tiles it has inside the view, never a lookup
+per cell, so a cell empty in every layer costs nothing whatever the count.
+*/
+typedef struct Struct_TileLayerState {
+  Struct_TileLayer layers[MAX_TILE_LAYERS];
+  uint32_t count;
+  uint32_t active;
+  size_t history_budget; // Undo memory of every layer.
+  Struct_StringPool strings; // Property keys and values of every layer.
+} Struct_TileLayerState;
+
+// Starts with the DEFAULT_TILE_LAYERS, each getting history_budget of undo.
+extern Enum_StatusCodes
+InitTileLayerState(Struct_TileLayerState *pTile_layer_state,
+                   size_t history_budget);
+extern void FreeTileLayerState(Struct_TileLayerState *pTile_layer_state);
+extern Enum_StatusCodes AddTileLayer(const char *name,
+                                     Struct_TileLayerState *pTile_layer_state,
+                                     uint32_t *pIndex);
+extern Enum_StatusCodes
+FindTileLayer(const char *name,
+              const Struct_TileLayerState *pTile_layer_state,
+              uint32_t *pIndex);
+extern Struct_TileLayer *
+GetActiveTileLayer(Struct_TileLayerState *pTile_layer_state);
+
+/*
+OBJ export of the layers. Each layer with tiles or properties is saved as an
+"o <name>" object of the same file, its properties after its tiles, empty
+ones are skipped. Tiles read before any object line, as in files from before
+layers, land on the first layer. Layers named in the file but missing are
+added. Visibility is a view setting like the zoom and is not saved.
+*/
+extern Enum_StatusCodes
+DumpLayersToFile(const Struct_TileLayerState *pTile_layer_state,
+                 const char *file_path, uint32_t tile_size);
+extern Enum_StatusCodes
+ParseFileToLayers(Struct_TileLayerState *pTile_layer_state,
+                  const char *file_path, uint32_t tile_size);
+
+/*
+The binary map file, the editor's own. The header is followed by the string
+pool, then every layer as its name padded to TILE_LAYER_NAME_LIMIT, its tiles
+as DumpTileHashMapBinary writes them and its properties. All sections are
+plain words, so saving is a few large writes and loading maps the file and
+copies tile records straight into chunk storage, with no text to format or
+parse either way. Layers are read back as in ParseFileToLayers, and the tile
+size saved goes to pTile_size.
+*/
+extern Enum_StatusCodes
+DumpLayersToBinary(const Struct_TileLayerState *pTile_layer_state,
+                   const char *file_path, uint32_t tile_size);
+extern Enum_StatusCodes
+ParseBinaryToLayers(Struct_TileLayerState *pTile_layer_state,
+                    const char *file_path, uint32_t *pTile_size);
\ No newline at end of file
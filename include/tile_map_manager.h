@@ -6,23 +6,379 @@
 typedef struct Struct_TileHashNode {
   int32_t x, y;
   uint8_t r, g, b;
-  struct Struct_TileHashNode *next; // Hashmap with chaining.
+  uint8_t variant; // Filled in by lookups, ignored when inserting.
 } Struct_TileHashNode;
 
-extern Enum_StatusCodes InitTileHashMap(Struct_TileHashNode ***pTile_hash_arr);
-extern void FreeTileHashMap(Struct_TileHashNode ***pTile_hash_arr);
+/*
+Auto tiling variant of a tile, the set of its 8 neighbours that are occupied.
+A corner only counts when both edges beside it do too, since that is the only
+case a corner piece changes, which leaves 47 distinct variants.
+*/
+#define TILE_NEIGHBOUR_N (1 << 0)
+#define TILE_NEIGHBOUR_NE (1 << 1)
+#define TILE_NEIGHBOUR_E (1 << 2)
+#define TILE_NEIGHBOUR_SE (1 << 3)
+#define TILE_NEIGHBOUR_S (1 << 4)
+#define TILE_NEIGHBOUR_SW (1 << 5)
+#define TILE_NEIGHBOUR_W (1 << 6)
+#define TILE_NEIGHBOUR_NW (1 << 7)
+
+/*
+Tiles are stored in square chunks of contiguous colour data and only the chunks
+are hashed, so neighbouring tiles share a single lookup and sit next to each
+other in memory.
+*/
+#define TILE_CHUNK_SHIFT 5
+#define TILE_CHUNK_SIZE (1 << TILE_CHUNK_SHIFT)
+#define TILE_CHUNK_MASK (TILE_CHUNK_SIZE - 1)
+#define TILE_CHUNK_AREA (TILE_CHUNK_SIZE * TILE_CHUNK_SIZE)
+
+typedef struct Struct_TileChunk {
+  int32_t chunk_x, chunk_y;
+  uint32_t count;
+  uint32_t dense_index; // Position in Struct_TileHashMap.chunks.
+  uint32_t refs;        // Map and snapshot directories listing this chunk.
+  uint32_t occupied[TILE_CHUNK_SIZE]; // One bit per tile, one word per row.
+  uint16_t cells[TILE_CHUNK_AREA]; // Palette indices, indexed by y * SIZE + x.
+  uint8_t variants[TILE_CHUNK_AREA]; // Only meaningful for occupied cells.
+  struct Struct_TileChunk *next_free; // Only used while in the free list.
+} Struct_TileChunk;
+
+/*
+Chunks are carved out of slabs owned by the map instead of being malloc'd one
+by one. Released chunks go to a free list and the slabs themselves are only
+given back in FreeTileHashMap, all at once.
+*/
+#define TILE_CHUNKS_PER_SLAB 64
+
+typedef struct Struct_TileChunkSlab {
+  struct Struct_TileChunkSlab *next;
+  Struct_TileChunk chunks[TILE_CHUNKS_PER_SLAB];
+} Struct_TileChunkSlab;
+
+/*
+Maps only ever use a handful of distinct colours, so tiles store an index into
+a per map palette instead of their rgb. Colours are interned on first use and
+never removed, lookup is a small open addressing table of packed rgb keys.
+*/
+#define TILE_PALETTE_MAX_COLORS 65536
+
+typedef struct Struct_TilePalette {
+  uint8_t (*colors)[3];
+  uint32_t count, capacity;
+  uint32_t *lookup; // Palette index plus one, 0 marks an empty slot.
+  uint32_t lookup_capacity;
+} Struct_TilePalette;
+
+/*
+Tile state as one word, used by block transfers and the edit history. 0 for an
+empty cell, otherwise the packed rgb with bit 24 set so that black stays
+distinguishable from empty.
+*/
+#define TILE_VALUE_EMPTY 0
+#define TILE_VALUE(r, g, b)                                                    \
+  (0x1000000U | ((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (uint32_t)(b))
+
+// Inclusive rectangle of grid coordinates.
+typedef struct Struct_TileBounds {
+  int32_t min_x, min_y, max_x, max_y;
+} Struct_TileBounds;
+
+/*
+A single slot of the open addressing table. The low 7 bits of probe_len hold
+the distance from the home slot plus one (0 marks an empty slot), the high bit
+marks a tombstone left behind in a table that is being drained by a resize.
+An insert whose probe would outgrow those 7 bits rebuilds a bigger table.
+*/
+typedef struct Struct_TileHashSlot {
+  int32_t chunk_x, chunk_y;
+  uint8_t probe_len;
+  Struct_TileChunk *chunk;
+} Struct_TileHashSlot;
+
+/*
+Robin Hood hashmap of chunks with power of two capacity. Growing does not
+rehash everything at once, instead the previous table is kept in old_slots and
+drained a few slots at a time on every mutation, so a resize never stalls a
+frame.
+
+Every live chunk is also listed once in the dense chunks array, removal swaps
+the last entry into the hole. Full map passes walk that array and cost
+O(chunk_count) no matter how large the tables have grown. Slab allocated
+chunks never move, so the slots point straight at them rather than at their
+dense position, saving lookups a hop.
+
+bounds only ever grows on insert. Removing a tile on its edge just marks it
+stale, so it stays a superset of the occupied tiles at O(1) per edit and is
+tightened on demand by GetTileHashMapBounds. Each chunk's count doubles as a
+per region occupancy counter.
+
+While pShared_snapshot is set the map is still reading that snapshot's tables
+and palette, the first mutation afterwards gives it copies of its own.
+
+Variants are kept up to date on commit, see BeginTileTransaction. Only the
+tiles around cells that were filled or emptied get recomputed, a single edit
+only ever touching its 3x3 neighbourhood.
+*/
+typedef struct Struct_TileHashMap {
+  Struct_TileHashSlot *slots;
+  uint32_t capacity;
+  uint32_t chunk_count; // Live chunks across both tables.
+  uint32_t tile_count;
+  Struct_TileHashSlot *old_slots;
+  uint32_t old_capacity;
+  uint32_t old_chunk_count; // Live chunks still waiting in old_slots.
+  uint32_t migrate_index;
+  Struct_TileChunk **chunks; // Dense, chunk_count entries.
+  uint32_t chunks_capacity;
+  Struct_TileChunkSlab *slabs; // Newest first.
+  uint32_t slab_used;          // Chunks handed out from the newest slab.
+  Struct_TileChunk *free_chunks;
+  Struct_TilePalette palette;
+  Struct_TileBounds bounds; // Meaningless while tile_count is 0.
+  uint8_t bounds_stale;
+  const struct Struct_TileHashMap *pShared_snapshot;
+  uint32_t transaction_depth;        // Open BeginTileTransaction calls.
+  Struct_TileBounds pending_reshape; // Cells filled or emptied since commit.
+  uint8_t has_pending_reshape;
+  Struct_TileBounds *reshape_rects; // The same cells, far apart edits apart.
+  uint32_t reshape_rect_count, reshape_rect_capacity;
+} Struct_TileHashMap;
+
+/*
+Walks the occupied tiles inside an inclusive rectangle of grid coordinates, so
+callers pay for the tiles that exist rather than for every cell. Small
+rectangles look up each chunk they overlap, large ones walk the dense chunk
+array instead, whichever touches fewer chunks. The rectangle is first clipped to
+the map bounds. The map must not be mutated mid walk.
+*/
+typedef struct Struct_TileRangeIter {
+  const Struct_TileHashMap *pTile_hash_map;
+  int32_t min_x, min_y, max_x, max_y;
+  uint8_t walk_dense;
+  int32_t chunk_x, chunk_y; // Next chunk to look up when not walking densely.
+  uint32_t dense_index;     // Next dense chunk when walking densely.
+  const Struct_TileChunk *chunk;
+  uint32_t row, last_row; // Rows of the current chunk inside the rectangle.
+  uint32_t col_mask;      // Columns of the current chunk inside the rectangle.
+  uint32_t row_bits;      // Occupied tiles not yet returned in the current row.
+} Struct_TileRangeIter;
+
+#define KNUTHS_X_MULTIPLIER 2654435761U
+#define KNUTHS_Y_MULTIPLIER 2246822519U
+
+// Hash of a pair of coordinates, shared by the tables keyed on them.
+extern uint32_t KnuthMultiplicativeHash(int32_t x, int32_t y);
+/*
+Tables are indexed by masking off the low bits, which are the weakest bits of
+a multiplicative hash, so this folds the high bits down before that happens.
+*/
+extern uint32_t MixHashBits(uint32_t hash);
+extern Enum_StatusCodes InitTileHashMap(Struct_TileHashMap *pTile_hash_map);
+extern void FreeTileHashMap(Struct_TileHashMap *pTile_hash_map);
+/*
+Makes room for chunk_count more chunks, so inserting them never grows or
+rehashes the table. Any rehash needed happens right here, in one go.
+*/
+extern Enum_StatusCodes ReserveTileHashMap(uint32_t chunk_count,
+                                           Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes AddTileHashMapEntry(int32_t x, int32_t y, uint8_t r,
+                                            uint8_t g, uint8_t b,
+                                            Struct_TileHashMap *pTile_hash_map);
+/*
+Inserts a buffer of tiles, reserving for the chunks it covers first and reusing
+the chunk and palette lookups between consecutive tiles, so input ordered by
+chunk (as DumpDataToFile writes it) costs about one lookup per chunk. Pass
+is_unique only when no tile repeats within the buffer or already exists in
+the map, the occupancy checks are skipped and the tile count trusts the caller.
+*/
+extern Enum_StatusCodes
+AddTileHashMapEntries(const Struct_TileHashNode *tiles, uint32_t count,
+                      uint8_t is_unique, Struct_TileHashMap *pTile_hash_map);
+/*
+Batches variant updates. A mutation outside a transaction works out the
+variants around it on its own. Inside one the cells it filled or emptied are
+only gathered, and the outermost commit recomputes them all at once, so a
+multi tile edit walks each neighbourhood once instead of once per tile.
+Transactions nest. Variants are stale until the commit.
+*/
+extern void BeginTileTransaction(Struct_TileHashMap *pTile_hash_map);
+extern void CommitTileTransaction(Struct_TileHashMap *pTile_hash_map);
+/*
+Fill and clear every cell of an inclusive rectangle, working a chunk row at a
+time on the occupancy masks and cell rows instead of looking up every tile.
+*/
+extern Enum_StatusCodes FillTileHashMapRect(int32_t min_x, int32_t min_y,
+                                            int32_t max_x, int32_t max_y,
+                                            uint8_t r, uint8_t g, uint8_t b,
+                                            Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes
+EraseTileHashMapRect(int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y,
+                     Struct_TileHashMap *pTile_hash_map);
+/*
+Block transfers between the map and a row major buffer of width * height
+TILE_VALUEs whose top left lands on (min_x, min_y), a chunk row at a time.
+Writing replaces every cell of the block, empty values clear theirs.
+*/
+extern Enum_StatusCodes
+ReadTileHashMapBlock(int32_t min_x, int32_t min_y, uint32_t width,
+                     uint32_t height, const Struct_TileHashMap *pTile_hash_map,
+                     uint32_t *pDest);
 extern Enum_StatusCodes
-AddTileHashMapEntry(int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b,
-                    Struct_TileHashNode **tile_hash_arr);
-extern Enum_StatusCodes AccessTileHashMap(int32_t x, int32_t y,
-                                          Struct_TileHashNode **tile_hash_arr,
-                                          Struct_TileHashNode **pDest);
+WriteTileHashMapBlock(int32_t min_x, int32_t min_y, uint32_t width,
+                      uint32_t height, const uint32_t *values,
+                      Struct_TileHashMap *pTile_hash_map);
+/*
+Recolours every tile of one colour inside pRegion, or across the whole map when
+it is NULL. A whole map replace with a colour not in the palette yet just
+recolours the palette entry, without touching a tile. Otherwise the palette
+indices of the chunks are remapped in flat vectorizable passes, never looking
+up a tile. FAILURE if no tile can have the colour.
+*/
 extern Enum_StatusCodes
-PopTileHashMapEntry(int32_t x, int32_t y, Struct_TileHashNode **tile_hash_arr);
+ReplaceTileHashMapColor(uint8_t from_r, uint8_t from_g, uint8_t from_b,
+                        uint8_t to_r, uint8_t to_g, uint8_t to_b,
+                        const Struct_TileBounds *pRegion,
+                        Struct_TileHashMap *pTile_hash_map);
+extern Enum_StatusCodes
+AccessTileHashMap(int32_t x, int32_t y,
+                  const Struct_TileHashMap *pTile_hash_map,
+                  Struct_TileHashNode *pDest);
+extern Enum_StatusCodes PopTileHashMapEntry(int32_t x, int32_t y,
+                                            Struct_TileHashMap *pTile_hash_map);
+/*
+Looks up count coordinates at once, hashing them in one pass and prefetching
+their slots and cells before probing, so the cache misses overlap instead of
+being paid one after another. pStatus_arr gets what AccessTileHashMap would
+have returned for each coordinate, pDest_arr is only written on SUCCESS.
+Returns SUCCESS only if every coordinate was found.
+*/
+extern Enum_StatusCodes
+AccessTileHashMapBatch(const int32_t *xs, const int32_t *ys, uint32_t count,
+                       const Struct_TileHashMap *pTile_hash_map,
+                       Struct_TileHashNode *pDest_arr,
+                       Enum_StatusCodes *pStatus_arr);
+extern Enum_StatusCodes
+AccessTileChunk(int32_t chunk_x, int32_t chunk_y,
+                const Struct_TileHashMap *pTile_hash_map,
+                const Struct_TileChunk **pDest);
+extern void InitTileRangeIter(Struct_TileRangeIter *pIter,
+                              const Struct_TileHashMap *pTile_hash_map,
+                              int32_t min_x, int32_t min_y, int32_t max_x,
+                              int32_t max_y);
+extern Enum_StatusCodes NextTileInRange(Struct_TileRangeIter *pIter,
+                                        Struct_TileHashNode *pDest);
+/*
+Freezes the current contents of the map into pSnapshot in O(1), which can then
+be passed to any function taking a const map. Nothing is copied up front, the
+first edit afterwards copies the map's tables (not the tiles) and every chunk
+is only copied when an edit first touches it. A snapshot can be read from any
+thread while the map keeps being edited, but creating and freeing it must
+happen on the thread editing the map, and every snapshot has to be freed before
+the map itself.
+*/
+extern Enum_StatusCodes CreateTileSnapshot(Struct_TileHashMap *pTile_hash_map,
+                                           Struct_TileHashMap *pSnapshot);
+extern void FreeTileSnapshot(Struct_TileHashMap *pSnapshot,
+                             Struct_TileHashMap *pTile_hash_map);
+/*
+Tight bounds of the occupied tiles, FAILURE if the map is empty. Only rescans
+the chunks when a removal left the cached bounds stale.
+*/
+extern Enum_StatusCodes GetTileHashMapBounds(Struct_TileHashMap *pTile_hash_map,
+                                             Struct_TileBounds *pDest);
+/*
+Number of occupied tiles inside an inclusive rectangle. Chunks fully inside it
+contribute their count without looking at their tiles.
+*/
+extern uint32_t CountTilesInRange(const Struct_TileHashMap *pTile_hash_map,
+                                  int32_t min_x, int32_t min_y, int32_t max_x,
+                                  int32_t max_y);
 
-extern Enum_StatusCodes DumpDataToFile(Struct_TileHashNode **tile_hash_arr,
-                                       const char *file_path,
-                                       uint32_t tile_size);
-extern Enum_StatusCodes ParseFileToData(Struct_TileHashNode **tile_hash_arr,
+extern Enum_StatusCodes
+DumpDataToFile(const Struct_TileHashMap *pTile_hash_map, const char *file_path,
+               uint32_t tile_size);
+/*
+Loads every tile of the file into the map, ignoring any other lines. Parsing is
+spread over the cores by ParseTextInParallel, which also reads files holding
+several maps, or more than tiles.
+*/
+extern Enum_StatusCodes ParseFileToData(Struct_TileHashMap *pTile_hash_map,
                                         const char *file_path,
                                         uint32_t tile_size);
+/*
+Text halves of the above, for files holding several maps as "o <name>"
+objects or other data between them. Dumping goes through a writer shared with
+that other data, pVert_count carries the vertex indices on from one map to
+the next. Parsing scans the text from *pCursor to
+end in place, usually a mapped file, and stops after the first line that is
+not part of a tile. pLine then points at that line inside the text, with its
+length but no newline in pLine_length, which stays 0 once the text runs out.
+*pCursor is left after the line. Lines can be of any length.
+*/
+extern void DumpDataToText(const Struct_TileHashMap *pTile_hash_map,
+                           Struct_TextWriter *pWriter, uint32_t tile_size,
+                           int32_t *pVert_count);
+extern Enum_StatusCodes ParseTextToData(Struct_TileHashMap *pTile_hash_map,
+                                        const char **pCursor, const char *end,
+                                        uint32_t tile_size, const char **pLine,
+                                        size_t *pLine_length);
+
+// Past this many threads the merge, which is serial, takes most of a load.
+#define PARSE_MAX_THREADS 8
+
+// Tiles of a range up to the line that ends them, if any.
+typedef struct Struct_ParsedTextSegment {
+  Struct_TileHashMap tile_hash_map; // Only initialised when has_tiles is set.
+  uint8_t has_tiles;
+  const char *line; // NULL when the range ran out instead.
+  size_t line_length;
+} Struct_ParsedTextSegment;
+
+typedef struct Struct_ParsedTextRange {
+  const char *begin, *end;
+  uint32_t tile_size;
+  Struct_ParsedTextSegment *segments;
+  uint32_t segment_count, segments_capacity;
+  Enum_StatusCodes status; // Whatever stopped the range early.
+} Struct_ParsedTextRange;
+
+typedef struct Struct_ParsedText {
+  Struct_ParsedTextRange ranges[PARSE_MAX_THREADS];
+  uint32_t range_count;
+  uint32_t range_index, segment_index; // Next segment to merge.
+} Struct_ParsedText;
+
+/*
+ParseTextToData split over up to one thread per core for large texts. The
+text is cut into ranges at blank lines, which only ever sit between rects, and
+each range is parsed into maps of its own, a new one after every line that is
+not part of a tile. MergeParsedText then hands them out in text order with the
+same contract as ParseTextToData. Their chunks are handed over whole rather
+than copied, and the variants are worked out across the cores as well.
+Failures of a range come out of MergeParsedText once it gets there, as they
+would have in text order. The text must outlive pParsed, pLine points into it.
+*/
+extern void ParseTextInParallel(const char *text, const char *end,
+                                uint32_t tile_size, Struct_ParsedText *pParsed);
+extern Enum_StatusCodes MergeParsedText(Struct_ParsedText *pParsed,
+                                        Struct_TileHashMap *pTile_hash_map,
+                                        const char **pLine,
+                                        size_t *pLine_length);
+extern void FreeParsedText(Struct_ParsedText *pParsed);
+
+/*
+Binary form of a map, the bulk of DumpLayersToBinary files. Three words give
+the palette, chunk and tile counts and a fourth is reserved, then comes the
+palette as rgb plus a padding byte per colour, then one record per chunk: its
+coordinates and tile count, then either a (cell, palette index) pair of words
+per tile or, for fuller chunks, the occupancy rows followed by the palette
+index of every occupied cell in row order. Loading copies the records straight
+into chunk storage, remapping palette indices since the map may hold colours
+of its own, and works the variants out again like any other change.
+*/
+extern Enum_StatusCodes
+DumpTileHashMapBinary(const Struct_TileHashMap *pTile_hash_map, FILE *file);
+extern Enum_StatusCodes
+LoadTileHashMapBinary(const uint8_t **pCursor, const uint8_t *end,
+                      Struct_TileHashMap *pTile_hash_map);
\ No newline at end of file
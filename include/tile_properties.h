@@ -0,0 +1,120 @@
+#pragma once
+
+#include "../include/common.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest string a property key or value can be, without the terminator.
+#define TILE_PROPERTY_STRING_LIMIT 192
+// Room for a saved property line, a string and its id included.
+#define TILE_PROPERTY_LINE_SIZE (TILE_PROPERTY_STRING_LIMIT + 32)
+
+/*
+Every distinct string is stored once and handed out as an id, so properties
+compare and hash as plain integers and repeated values like "door" cost 4
+bytes each. Strings are packed one after the other in chars, the lookup is a
+small open addressing table like the palette's. Strings are never removed.
+*/
+typedef struct Struct_StringPool {
+  char *chars;
+  size_t chars_size, chars_capacity;
+  uint32_t *offsets; // Into chars, indexed by id.
+  uint32_t count, capacity;
+  uint32_t *lookup; // Id plus one, 0 marks an empty slot.
+  uint32_t lookup_capacity;
+} Struct_StringPool;
+
+typedef struct Struct_TileProperty {
+  int32_t x, y;
+  uint32_t key, value; // Ids in the string pool.
+} Struct_TileProperty;
+
+/*
+Sparse key value properties of tiles, like spawn points or door ids. Kept in a
+table of their own so tile storage, lookups and rendering never pay for them.
+Properties are dense in an array, removal swaps the last one into the hole,
+and indexed by (x, y, key) through a linear probing table. They belong to the
+cell, so erasing a tile leaves them in place.
+*/
+typedef struct Struct_TilePropertyTable {
+  Struct_TileProperty *properties;
+  uint32_t count, capacity;
+  uint32_t *index; // Property position plus one, 0 marks an empty slot.
+  uint32_t index_capacity;
+} Struct_TilePropertyTable;
+
+/*
+Ties the string ids of a file being loaded to the ids they got in the pool,
+since the pool may already hold strings of its own.
+*/
+typedef struct Struct_TilePropertyLoader {
+  uint32_t *string_ids; // Pool id plus one, indexed by file id.
+  uint32_t capacity;
+} Struct_TilePropertyLoader;
+
+// A zeroed pool, table or loader is also a valid empty one.
+extern void InitStringPool(Struct_StringPool *pString_pool);
+extern void FreeStringPool(Struct_StringPool *pString_pool);
+/*
+Id of the string, adding it on first use. Strings longer than
+TILE_PROPERTY_STRING_LIMIT or holding a newline are refused.
+*/
+extern Enum_StatusCodes InternString(const char *string,
+                                     Struct_StringPool *pString_pool,
+                                     uint32_t *pId);
+// FAILURE when the string was never interned, without adding it.
+extern Enum_StatusCodes
+FindInternedString(const char *string, const Struct_StringPool *pString_pool,
+                   uint32_t *pId);
+extern const char *GetInternedString(uint32_t id,
+                                     const Struct_StringPool *pString_pool);
+
+extern void InitTilePropertyTable(Struct_TilePropertyTable *pProperty_table);
+extern void FreeTilePropertyTable(Struct_TilePropertyTable *pProperty_table);
+// Adds the property or overwrites its value.
+extern Enum_StatusCodes
+SetTileProperty(int32_t x, int32_t y, uint32_t key, uint32_t value,
+                Struct_TilePropertyTable *pProperty_table);
+extern Enum_StatusCodes
+GetTileProperty(int32_t x, int32_t y, uint32_t key,
+                const Struct_TilePropertyTable *pProperty_table,
+                uint32_t *pValue);
+extern Enum_StatusCodes
+RemoveTileProperty(int32_t x, int32_t y, uint32_t key,
+                   Struct_TilePropertyTable *pProperty_table);
+
+/*
+Properties are saved as "p x y key value" lines with string ids, each string
+written once as an "s id string" line before its first use. pString_written
+has a flag per pool string and is shared by every table saved to the same
+file. Loading takes those lines back one at a time.
+*/
+extern void
+DumpTilePropertiesToText(const Struct_TilePropertyTable *pProperty_table,
+                         const Struct_StringPool *pString_pool,
+                         Struct_TextWriter *pWriter, uint8_t *pString_written);
+extern Enum_StatusCodes
+ParseTilePropertyLine(const char *line, Struct_TilePropertyLoader *pLoader,
+                      Struct_StringPool *pString_pool,
+                      Struct_TilePropertyTable *pProperty_table);
+extern void FreeTilePropertyLoader(Struct_TilePropertyLoader *pLoader);
+
+/*
+Binary halves of the above. The pool is written once per file ahead of every
+table, as its string count and size then the strings back to back with their
+terminators, and properties keep their pool ids. Loading the pool interns
+every string and fills the loader, tables loaded after it go through it.
+*/
+extern Enum_StatusCodes
+DumpStringPoolBinary(const Struct_StringPool *pString_pool, FILE *file);
+extern Enum_StatusCodes LoadStringPoolBinary(const uint8_t **pCursor,
+                                             const uint8_t *end,
+                                             Struct_TilePropertyLoader *pLoader,
+                                             Struct_StringPool *pString_pool);
+extern Enum_StatusCodes
+DumpTilePropertiesBinary(const Struct_TilePropertyTable *pProperty_table,
+                         FILE *file);
+extern Enum_StatusCodes
+LoadTilePropertiesBinary(const uint8_t **pCursor, const uint8_t *end,
+                         const Struct_TilePropertyLoader *pLoader,
+                         Struct_TilePropertyTable *pProperty_table);
\ No newline at end of file
@@ -1,7 +1,42 @@
+// mmap and friends are POSIX, not part of the C standard asked for.
+#define _POSIX_C_SOURCE 200809L
+
 #include "../include/common.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Text export buffer, flushed with one write call each time it fills.
+#define TEXT_WRITER_BUFFER_SIZE (4 * 1024 * 1024)
 
 uint32_t grid_size = 50;
 
+static void FlushTextWriter(Struct_TextWriter *pWriter);
+
+static void FlushTextWriter(Struct_TextWriter *pWriter) {
+  size_t written = 0;
+
+  while (written < pWriter->size && pWriter->status == SUCCESS) {
+    ssize_t result = write(pWriter->fd, &pWriter->buffer[written],
+                           pWriter->size - written);
+    if (result < 0 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      pWriter->status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+      Logger(&pWriter->status, NULL, "Error produced by FlushTextWriter()",
+             OUTPUT_LOG_STREAM);
+      break;
+    }
+    written += result;
+  }
+  pWriter->size = 0;
+}
+
 void Logger(Enum_StatusCodes *pStatus_codes,
             const char *(*extra_logs_callback)(void), const char *logs,
             FILE *output_stream) {
@@ -56,4 +91,197 @@ void Logger(Enum_StatusCodes *pStatus_codes,
       fprintf(output_stream, "No status codes provided.\n");
     }
   }
+}
+
+Enum_StatusCodes MapFile(const char *file_path, const void **pData,
+                         size_t *pSize) {
+  Enum_StatusCodes status = SUCCESS;
+  struct stat file_stat;
+
+  int32_t fd = open(file_path, O_RDONLY);
+  if (fd < 0) {
+    status = INVALID_FILE_PATH | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by MapFile()", OUTPUT_LOG_STREAM);
+    return status;
+  }
+  if (fstat(fd, &file_stat) || file_stat.st_size < 0) {
+    close(fd);
+    status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by MapFile()", OUTPUT_LOG_STREAM);
+    return status;
+  }
+  *pData = NULL;
+  *pSize = file_stat.st_size;
+  if (!*pSize) {
+    close(fd);
+    return status;
+  }
+
+  // The mapping outlives the descriptor, and files are read front to back.
+  void *data = mmap(NULL, *pSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by MapFile()", OUTPUT_LOG_STREAM);
+    return status;
+  }
+  posix_madvise(data, *pSize, POSIX_MADV_SEQUENTIAL);
+  *pData = data;
+
+  return status;
+}
+
+void UnmapFile(const void *data, size_t size) {
+  if (data) {
+    munmap((void *)data, size);
+  }
+}
+
+uint32_t GetProcessorCount(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (count > 1) ? (uint32_t)count : 1;
+}
+
+Enum_StatusCodes OpenTextWriter(const char *file_path,
+                                Struct_TextWriter *pWriter) {
+  Enum_StatusCodes status = SUCCESS;
+
+  *pWriter = (Struct_TextWriter){.capacity = TEXT_WRITER_BUFFER_SIZE};
+  if (!(pWriter->buffer = malloc(TEXT_WRITER_BUFFER_SIZE))) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by OpenTextWriter()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  // Same permissions as fopen would give.
+  pWriter->fd = open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (pWriter->fd < 0) {
+    free(pWriter->buffer);
+    pWriter->buffer = NULL;
+    status = INVALID_FILE_PATH | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by OpenTextWriter()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  return status;
+}
+
+Enum_StatusCodes CloseTextWriter(Struct_TextWriter *pWriter) {
+  FlushTextWriter(pWriter);
+  if (close(pWriter->fd) && pWriter->status == SUCCESS) {
+    pWriter->status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+    Logger(&pWriter->status, NULL, "Error produced by CloseTextWriter()",
+           OUTPUT_LOG_STREAM);
+  }
+  free(pWriter->buffer);
+  pWriter->buffer = NULL;
+
+  return pWriter->status;
+}
+
+char *ReserveText(Struct_TextWriter *pWriter, size_t size) {
+  if (pWriter->size + size > pWriter->capacity) {
+    FlushTextWriter(pWriter);
+  }
+  if (pWriter->status != SUCCESS || size > pWriter->capacity) {
+    return NULL;
+  }
+
+  return &pWriter->buffer[pWriter->size];
+}
+
+void CommitText(Struct_TextWriter *pWriter, const char *end) {
+  pWriter->size = end - pWriter->buffer;
+}
+
+void WriteText(Struct_TextWriter *pWriter, const char *text, size_t length) {
+  while (length) {
+    size_t piece = (length < pWriter->capacity) ? length : pWriter->capacity;
+    char *dest = ReserveText(pWriter, piece);
+    if (!dest) {
+      return;
+    }
+    memcpy(dest, text, piece);
+    CommitText(pWriter, dest + piece);
+    text += piece;
+    length -= piece;
+  }
+}
+
+// Two digits at a time from a table, the divisions dominate otherwise.
+char *FormatDecimal(char *dest, int64_t value) {
+  static const char digit_pairs[] = "00010203040506070809"
+                                    "10111213141516171819"
+                                    "20212223242526272829"
+                                    "30313233343536373839"
+                                    "40414243444546474849"
+                                    "50515253545556575859"
+                                    "60616263646566676869"
+                                    "70717273747576777879"
+                                    "80818283848586878889"
+                                    "90919293949596979899";
+  uint64_t magnitude = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+  uint32_t length = 1;
+
+  if (value < 0) {
+    *dest++ = '-';
+  }
+  // Sized up front, so digits go straight to dest from the back.
+  for (uint64_t bound = 10; length < 20 && magnitude >= bound; bound *= 10) {
+    length++;
+  }
+  char *end = dest + length, *out = end;
+  while (magnitude >= 100) {
+    out -= 2;
+    memcpy(out, &digit_pairs[(magnitude % 100) * 2], 2);
+    magnitude /= 100;
+  }
+  if (magnitude >= 10) {
+    memcpy(out - 2, &digit_pairs[magnitude * 2], 2);
+  } else {
+    out[-1] = '0' + magnitude;
+  }
+
+  return end;
+}
+
+Enum_StatusCodes WriteBinary(const void *data, size_t size, FILE *file) {
+  static const uint8_t padding[BINARY_ALIGNMENT] = {0};
+  size_t padding_size = BINARY_ALIGN(size) - size;
+
+  if ((size && fwrite(data, 1, size, file) != size) ||
+      (padding_size &&
+       fwrite(padding, 1, padding_size, file) != padding_size)) {
+    return FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+  }
+
+  return SUCCESS;
+}
+
+Enum_StatusCodes MapBinary(const void **pData, size_t size,
+                           const uint8_t **pCursor, const uint8_t *end) {
+  // The last value of a file may end without its padding.
+  if (size > (size_t)(end - *pCursor)) {
+    return FAILURE;
+  }
+  *pData = *pCursor;
+  *pCursor += (BINARY_ALIGN(size) > (size_t)(end - *pCursor))
+                  ? (size_t)(end - *pCursor)
+                  : BINARY_ALIGN(size);
+
+  return SUCCESS;
+}
+
+Enum_StatusCodes ReadBinary(void *pDest, size_t size, const uint8_t **pCursor,
+                            const uint8_t *end) {
+  const void *data;
+
+  if (MapBinary(&data, size, pCursor, end) != SUCCESS) {
+    return FAILURE;
+  }
+  memcpy(pDest, data, size);
+
+  return SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,252 @@
+#include "../include/concurrent_tile_map.h"
+#include <sched.h>
+#include <string.h>
+
+typedef enum Enum_ShardWrites { SHARD_ADD, SHARD_POP } Enum_ShardWrites;
+
+static Struct_TileMapShard *
+GetShard(int32_t x, int32_t y, Struct_ConcurrentTileMap *pConcurrent_tile_map);
+static uint32_t ArriveShard(Struct_TileMapShard *pShard);
+static void DepartShard(Struct_TileMapShard *pShard, uint32_t version_index);
+static Enum_StatusCodes ApplyShardWrite(Enum_ShardWrites write, int32_t x,
+                                        int32_t y, uint8_t r, uint8_t g,
+                                        uint8_t b,
+                                        Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes WriteShard(Enum_ShardWrites write, int32_t x,
+                                   int32_t y, uint8_t r, uint8_t g, uint8_t b,
+                                   Struct_TileMapShard *pShard);
+static uint8_t
+IsConcurrentTileOccupied(int64_t x, int64_t y,
+                         Struct_ConcurrentTileMap *pConcurrent_tile_map);
+static void FixEdgeVariant(Struct_TileHashNode *pTile,
+                           Struct_ConcurrentTileMap *pConcurrent_tile_map);
+
+static Struct_TileMapShard *
+GetShard(int32_t x, int32_t y, Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  uint64_t hash =
+      KnuthMultiplicativeHash(x >> TILE_CHUNK_SHIFT, y >> TILE_CHUNK_SHIFT);
+
+  /*
+  Picked by the topmost bits. The shard tables index by the low ones, which
+  would otherwise be the same few bits for every chunk of a shard.
+  */
+  return &pConcurrent_tile_map
+              ->shards[(hash * CONCURRENT_TILE_MAP_SHARDS) >> 32];
+}
+
+static uint32_t ArriveShard(Struct_TileMapShard *pShard) {
+  uint32_t version_index = atomic_load(&pShard->version_index);
+
+  atomic_fetch_add(&pShard->readers[version_index], 1);
+
+  return version_index;
+}
+
+static void DepartShard(Struct_TileMapShard *pShard, uint32_t version_index) {
+  atomic_fetch_sub(&pShard->readers[version_index], 1);
+}
+
+static Enum_StatusCodes ApplyShardWrite(Enum_ShardWrites write, int32_t x,
+                                        int32_t y, uint8_t r, uint8_t g,
+                                        uint8_t b,
+                                        Struct_TileHashMap *pTile_hash_map) {
+  if (write == SHARD_ADD) {
+    return AddTileHashMapEntry(x, y, r, g, b, pTile_hash_map);
+  }
+
+  return PopTileHashMapEntry(x, y, pTile_hash_map);
+}
+
+static Enum_StatusCodes WriteShard(Enum_ShardWrites write, int32_t x,
+                                   int32_t y, uint8_t r, uint8_t g, uint8_t b,
+                                   Struct_TileMapShard *pShard) {
+  Enum_StatusCodes status = SUCCESS;
+
+  pthread_mutex_lock(&pShard->write_lock);
+
+  uint32_t read_instance = atomic_load(&pShard->read_instance);
+  status = ApplyShardWrite(write, x, y, r, g, b,
+                           &pShard->instances[!read_instance]);
+  if (status != SUCCESS) {
+    // Nothing changed, or the copy is unusable, either way do not publish.
+    pthread_mutex_unlock(&pShard->write_lock);
+    return status;
+  }
+
+  atomic_store(&pShard->read_instance, !read_instance);
+
+  /*
+  Readers that picked up the old copy are counted under the old version index.
+  Toggling the index and draining both counters in turn guarantees all of them
+  have left, even ones that read the index just before it was toggled.
+  */
+  uint32_t prev_version = atomic_load(&pShard->version_index);
+  uint32_t next_version = !prev_version;
+  while (atomic_load(&pShard->readers[next_version])) {
+    sched_yield();
+  }
+  atomic_store(&pShard->version_index, next_version);
+  while (atomic_load(&pShard->readers[prev_version])) {
+    sched_yield();
+  }
+
+  /*
+  Replaying an edit that already succeeded on the twin copy can only fail on
+  allocation, in which case the logs already say so and the copies differ by
+  that one tile.
+  */
+  ApplyShardWrite(write, x, y, r, g, b, &pShard->instances[read_instance]);
+
+  pthread_mutex_unlock(&pShard->write_lock);
+
+  return status;
+}
+
+// Off the grid counts as empty, like a missing chunk.
+static uint8_t
+IsConcurrentTileOccupied(int64_t x, int64_t y,
+                         Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  const Struct_TileChunk *chunk = NULL;
+  uint8_t occupied;
+
+  if (x < INT32_MIN || x > INT32_MAX || y < INT32_MIN || y > INT32_MAX) {
+    return 0;
+  }
+  Struct_TileMapShard *shard = GetShard(x, y, pConcurrent_tile_map);
+  uint32_t version_index = ArriveShard(shard);
+  AccessTileChunk((int32_t)x >> TILE_CHUNK_SHIFT,
+                  (int32_t)y >> TILE_CHUNK_SHIFT,
+                  &shard->instances[atomic_load(&shard->read_instance)],
+                  &chunk);
+  occupied = chunk && HAS_FLAG(chunk->occupied[y & TILE_CHUNK_MASK],
+                               1U << (x & TILE_CHUNK_MASK));
+  DepartShard(shard, version_index);
+
+  return occupied;
+}
+
+/*
+A shard works variants out from its own chunks only, so a tile on a chunk edge
+misses the neighbours held by other shards. Those tiles get theirs again from
+whichever shards own the neighbours, with the same corner rule.
+*/
+static void FixEdgeVariant(Struct_TileHashNode *pTile,
+                           Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  int64_t x = pTile->x, y = pTile->y;
+  uint32_t local_x = x & TILE_CHUNK_MASK, local_y = y & TILE_CHUNK_MASK;
+
+  if (local_x && local_x < TILE_CHUNK_MASK && local_y &&
+      local_y < TILE_CHUNK_MASK) {
+    return;
+  }
+
+  uint8_t n = IsConcurrentTileOccupied(x, y - 1, pConcurrent_tile_map),
+          e = IsConcurrentTileOccupied(x + 1, y, pConcurrent_tile_map),
+          s = IsConcurrentTileOccupied(x, y + 1, pConcurrent_tile_map),
+          w = IsConcurrentTileOccupied(x - 1, y, pConcurrent_tile_map);
+  uint8_t variant = (n ? TILE_NEIGHBOUR_N : 0) | (e ? TILE_NEIGHBOUR_E : 0) |
+                    (s ? TILE_NEIGHBOUR_S : 0) | (w ? TILE_NEIGHBOUR_W : 0);
+  if (n && e && IsConcurrentTileOccupied(x + 1, y - 1, pConcurrent_tile_map)) {
+    variant |= TILE_NEIGHBOUR_NE;
+  }
+  if (s && e && IsConcurrentTileOccupied(x + 1, y + 1, pConcurrent_tile_map)) {
+    variant |= TILE_NEIGHBOUR_SE;
+  }
+  if (s && w && IsConcurrentTileOccupied(x - 1, y + 1, pConcurrent_tile_map)) {
+    variant |= TILE_NEIGHBOUR_SW;
+  }
+  if (n && w && IsConcurrentTileOccupied(x - 1, y - 1, pConcurrent_tile_map)) {
+    variant |= TILE_NEIGHBOUR_NW;
+  }
+  pTile->variant = variant;
+}
+
+Enum_StatusCodes
+InitConcurrentTileMap(Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  Enum_StatusCodes status = SUCCESS;
+
+  memset(pConcurrent_tile_map, 0, sizeof(Struct_ConcurrentTileMap));
+  for (int32_t i = 0; i < CONCURRENT_TILE_MAP_SHARDS; i++) {
+    Struct_TileMapShard *shard = &pConcurrent_tile_map->shards[i];
+    atomic_init(&shard->readers[0], 0);
+    atomic_init(&shard->readers[1], 0);
+    atomic_init(&shard->version_index, 0);
+    atomic_init(&shard->read_instance, 0);
+    pthread_mutex_init(&shard->write_lock, NULL);
+    status |= InitTileHashMap(&shard->instances[0]);
+    status |= InitTileHashMap(&shard->instances[1]);
+  }
+
+  if (status != SUCCESS) {
+    // Freeing maps that never got initialized is fine, they are zeroed.
+    FreeConcurrentTileMap(pConcurrent_tile_map);
+  }
+
+  return status;
+}
+
+void FreeConcurrentTileMap(Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  for (int32_t i = 0; i < CONCURRENT_TILE_MAP_SHARDS; i++) {
+    Struct_TileMapShard *shard = &pConcurrent_tile_map->shards[i];
+    FreeTileHashMap(&shard->instances[0]);
+    FreeTileHashMap(&shard->instances[1]);
+    pthread_mutex_destroy(&shard->write_lock);
+  }
+}
+
+Enum_StatusCodes
+AddConcurrentTileMapEntry(int32_t x, int32_t y, uint8_t r, uint8_t g, uint8_t b,
+                          Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  return WriteShard(SHARD_ADD, x, y, r, g, b,
+                    GetShard(x, y, pConcurrent_tile_map));
+}
+
+Enum_StatusCodes
+PopConcurrentTileMapEntry(int32_t x, int32_t y,
+                          Struct_ConcurrentTileMap *pConcurrent_tile_map) {
+  return WriteShard(SHARD_POP, x, y, 0, 0, 0,
+                    GetShard(x, y, pConcurrent_tile_map));
+}
+
+Enum_StatusCodes
+AccessConcurrentTileMap(int32_t x, int32_t y,
+                        Struct_ConcurrentTileMap *pConcurrent_tile_map,
+                        Struct_TileHashNode *pDest) {
+  Struct_TileMapShard *shard = GetShard(x, y, pConcurrent_tile_map);
+  uint32_t version_index = ArriveShard(shard);
+
+  Enum_StatusCodes status = AccessTileHashMap(
+      x, y, &shard->instances[atomic_load(&shard->read_instance)], pDest);
+
+  DepartShard(shard, version_index);
+  if (status == SUCCESS) {
+    FixEdgeVariant(pDest, pConcurrent_tile_map);
+  }
+
+  return status;
+}
+
+void ForEachConcurrentTileInRange(
+    int32_t min_x, int32_t min_y, int32_t max_x, int32_t max_y,
+    Struct_ConcurrentTileMap *pConcurrent_tile_map,
+    void (*callback)(const Struct_TileHashNode *pTile, void *pUser_data),
+    void *pUser_data) {
+  Struct_TileRangeIter iter;
+  Struct_TileHashNode tile;
+
+  for (int32_t i = 0; i < CONCURRENT_TILE_MAP_SHARDS; i++) {
+    Struct_TileMapShard *shard = &pConcurrent_tile_map->shards[i];
+    uint32_t version_index = ArriveShard(shard);
+
+    InitTileRangeIter(&iter,
+                      &shard->instances[atomic_load(&shard->read_instance)],
+                      min_x, min_y, max_x, max_y);
+    while (NextTileInRange(&iter, &tile) == SUCCESS) {
+      // Readers never wait, so reading other shards from inside this is fine.
+      FixEdgeVariant(&tile, pConcurrent_tile_map);
+      callback(&tile, pUser_data);
+    }
+
+    DepartShard(shard, version_index);
+  }
+}
\ No newline at end of file
@@ -0,0 +1,376 @@
+#include "../include/edit_history.h"
+#include <stdlib.h>
+
+static Struct_EditDelta *GetDelta(const Struct_EditHistory *pEdit_history,
+                                  uint32_t offset);
+static Enum_StatusCodes ApplyTileValue(int32_t x, int32_t y, uint32_t value,
+                                       Struct_TileHashMap *pTile_hash_map);
+static void AppendDelta(int32_t x, int32_t y, uint32_t run, uint32_t old_value,
+                        uint32_t new_value, Struct_EditHistory *pEdit_history);
+static void RecordKeptRuns(const Struct_TileChunk *chunk,
+                           const Struct_TileBounds *pRegion, uint16_t index,
+                           uint32_t value, Struct_EditHistory *pEdit_history);
+static Enum_StatusCodes ApplyColorRemap(const Struct_EditDelta *pTop_left,
+                                        const Struct_EditDelta *pBottom_right,
+                                        uint8_t undoing,
+                                        Struct_TileHashMap *pTile_hash_map);
+
+// Delta offset entries past the oldest one.
+static Struct_EditDelta *GetDelta(const Struct_EditHistory *pEdit_history,
+                                  uint32_t offset) {
+  return &pEdit_history->deltas[(pEdit_history->head + offset) %
+                                pEdit_history->capacity];
+}
+
+static Enum_StatusCodes ApplyTileValue(int32_t x, int32_t y, uint32_t value,
+                                       Struct_TileHashMap *pTile_hash_map) {
+  if (value == TILE_VALUE_EMPTY) {
+    // Failing just means the tile is already gone.
+    PopTileHashMapEntry(x, y, pTile_hash_map);
+    return SUCCESS;
+  }
+
+  return AddTileHashMapEntry(x, y, (value >> 16) & 0xFF, (value >> 8) & 0xFF,
+                             value & 0xFF, pTile_hash_map);
+}
+
+uint32_t GetTileValue(int32_t x, int32_t y,
+                      const Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileHashNode tile;
+
+  if (AccessTileHashMap(x, y, pTile_hash_map, &tile) != SUCCESS) {
+    return TILE_VALUE_EMPTY;
+  }
+
+  return TILE_VALUE(tile.r, tile.g, tile.b);
+}
+
+Enum_StatusCodes InitEditHistory(Struct_EditHistory *pEdit_history,
+                                 size_t memory_budget) {
+  Enum_StatusCodes status = SUCCESS;
+  size_t capacity = memory_budget / sizeof(Struct_EditDelta);
+
+  *pEdit_history = (Struct_EditHistory){0};
+  if (!capacity || capacity > UINT32_MAX) {
+    status = INVALID_FUNCTION_INPUT | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by InitEditHistory()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  pEdit_history->deltas = malloc(capacity * sizeof(Struct_EditDelta));
+  if (!pEdit_history->deltas) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by InitEditHistory()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  pEdit_history->capacity = capacity;
+  pEdit_history->group_pending = 1;
+
+  return status;
+}
+
+void FreeEditHistory(Struct_EditHistory *pEdit_history) {
+  free(pEdit_history->deltas);
+  *pEdit_history = (Struct_EditHistory){0};
+}
+
+void BeginEditGroup(Struct_EditHistory *pEdit_history) {
+  pEdit_history->group_pending = 1;
+  pEdit_history->group_dropped = 0;
+}
+
+void BeginEditTransaction(Struct_EditHistory *pEdit_history,
+                          Struct_TileHashMap *pTile_hash_map) {
+  BeginEditGroup(pEdit_history);
+  BeginTileTransaction(pTile_hash_map);
+}
+
+void CommitEditTransaction(Struct_EditHistory *pEdit_history,
+                           Struct_TileHashMap *pTile_hash_map) {
+  CommitTileTransaction(pTile_hash_map);
+  // Whatever comes next is a step of its own.
+  BeginEditGroup(pEdit_history);
+}
+
+static void AppendDelta(int32_t x, int32_t y, uint32_t run, uint32_t old_value,
+                        uint32_t new_value, Struct_EditHistory *pEdit_history) {
+  if (pEdit_history->applied == pEdit_history->capacity) {
+    if (!pEdit_history->group_pending && pEdit_history->groups == 1) {
+      /*
+      The step being recorded fills the whole ring by itself. Keeping half of
+      it would make undo leave the map in a state that never existed, so the
+      history is cleared and the rest of this step goes unrecorded.
+      */
+      pEdit_history->head = 0;
+      pEdit_history->applied = pEdit_history->count = 0;
+      pEdit_history->groups = 0;
+      pEdit_history->group_dropped = 1;
+      return;
+    }
+    // Drop the oldest step.
+    do {
+      pEdit_history->head =
+          (pEdit_history->head + 1) % pEdit_history->capacity;
+      pEdit_history->applied--;
+    } while (pEdit_history->applied &&
+             !HAS_FLAG(GetDelta(pEdit_history, 0)->run,
+                       EDIT_DELTA_GROUP_START));
+    pEdit_history->groups--;
+  }
+
+  uint8_t starts_group =
+      pEdit_history->group_pending || !pEdit_history->applied;
+  *GetDelta(pEdit_history, pEdit_history->applied) = (Struct_EditDelta){
+      .x = x,
+      .y = y,
+      .run = run | (starts_group ? EDIT_DELTA_GROUP_START : 0),
+      .old_value = old_value,
+      .new_value = new_value};
+  pEdit_history->count = ++pEdit_history->applied;
+  if (starts_group) {
+    pEdit_history->groups++;
+    pEdit_history->group_pending = 0;
+  }
+}
+
+void RecordTileEdit(int32_t x, int32_t y, uint32_t old_value,
+                    uint32_t new_value, Struct_EditHistory *pEdit_history) {
+  RecordTileRunEdit(x, y, 1, old_value, new_value, pEdit_history);
+}
+
+void RecordTileRunEdit(int32_t x, int32_t y, uint32_t length,
+                       uint32_t old_value, uint32_t new_value,
+                       Struct_EditHistory *pEdit_history) {
+  if (!length || old_value == new_value || pEdit_history->group_dropped) {
+    return;
+  }
+
+  // A new edit forks the timeline, whatever could be redone is gone.
+  pEdit_history->count = pEdit_history->applied;
+
+  if (!pEdit_history->group_pending && pEdit_history->applied) {
+    Struct_EditDelta *last =
+        GetDelta(pEdit_history, pEdit_history->applied - 1);
+    uint32_t run = last->run & EDIT_DELTA_RUN_MASK;
+    if (!HAS_FLAG(last->run, EDIT_DELTA_REMAP) && last->y == y &&
+        last->old_value == old_value &&
+        last->new_value == new_value &&
+        (uint64_t)run + length <= EDIT_DELTA_RUN_MASK) {
+      if ((int64_t)x == (int64_t)last->x + run) {
+        last->run += length;
+        return;
+      }
+      if ((int64_t)x + length == last->x) {
+        last->x = x;
+        last->run += length;
+        return;
+      }
+    }
+  }
+
+  // Only runs longer than a delta can hold take more than one.
+  for (int64_t run_x = x; length && !pEdit_history->group_dropped;) {
+    uint32_t run =
+        (length < EDIT_DELTA_RUN_MASK) ? length : EDIT_DELTA_RUN_MASK;
+    AppendDelta(run_x, y, run, old_value, new_value, pEdit_history);
+    run_x += run;
+    length -= run;
+  }
+}
+
+/*
+Runs of the chunk's cells inside the region holding palette index, recorded
+as going from value to value. Undo writes them back after the remap.
+*/
+static void RecordKeptRuns(const Struct_TileChunk *chunk,
+                           const Struct_TileBounds *pRegion, uint16_t index,
+                           uint32_t value, Struct_EditHistory *pEdit_history) {
+  int64_t start_x = (int64_t)chunk->chunk_x * TILE_CHUNK_SIZE,
+          start_y = (int64_t)chunk->chunk_y * TILE_CHUNK_SIZE;
+  int64_t first_col = pRegion->min_x - start_x,
+          last_col = pRegion->max_x - start_x;
+  int64_t first_row = pRegion->min_y - start_y,
+          last_row = pRegion->max_y - start_y;
+
+  first_col = (first_col < 0) ? 0 : first_col;
+  first_row = (first_row < 0) ? 0 : first_row;
+  last_col = (last_col > TILE_CHUNK_MASK) ? TILE_CHUNK_MASK : last_col;
+  last_row = (last_row > TILE_CHUNK_MASK) ? TILE_CHUNK_MASK : last_row;
+  if (first_col > last_col) {
+    return;
+  }
+  uint32_t col_mask = (UINT32_MAX >> (TILE_CHUNK_MASK - last_col)) &
+                      (UINT32_MAX << first_col);
+
+  for (int64_t row = first_row;
+       row <= last_row && !pEdit_history->group_dropped; row++) {
+    const uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+    uint32_t mask = 0;
+    for (uint32_t col = 0; col < TILE_CHUNK_SIZE; col++) {
+      mask |= (uint32_t)(cells[col] == index) << col;
+    }
+    mask &= chunk->occupied[row] & col_mask;
+
+    while (mask && !pEdit_history->group_dropped) {
+      uint32_t col = __builtin_ctz(mask), bits = mask >> col;
+      uint32_t run = ~bits ? (uint32_t)__builtin_ctz(~bits) : TILE_CHUNK_SIZE;
+      AppendDelta(start_x + col, start_y + row, run, value, value,
+                  pEdit_history);
+      // Shifting by the full width would be undefined.
+      uint32_t end = col + run;
+      mask = (end == TILE_CHUNK_SIZE) ? 0 : mask & (UINT32_MAX << end);
+    }
+  }
+}
+
+// A region spanning the whole grid stands for a whole map replace.
+static Enum_StatusCodes ApplyColorRemap(const Struct_EditDelta *pTop_left,
+                                        const Struct_EditDelta *pBottom_right,
+                                        uint8_t undoing,
+                                        Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileBounds region = {.min_x = pTop_left->x,
+                              .min_y = pTop_left->y,
+                              .max_x = pBottom_right->x,
+                              .max_y = pBottom_right->y};
+  uint8_t whole_map = region.min_x == INT32_MIN && region.min_y == INT32_MIN &&
+                      region.max_x == INT32_MAX && region.max_y == INT32_MAX;
+  uint32_t from = undoing ? pTop_left->new_value : pTop_left->old_value,
+           to = undoing ? pTop_left->old_value : pTop_left->new_value;
+
+  return ReplaceTileHashMapColor((from >> 16) & 0xFF, (from >> 8) & 0xFF,
+                                 from & 0xFF, (to >> 16) & 0xFF,
+                                 (to >> 8) & 0xFF, to & 0xFF,
+                                 whole_map ? NULL : &region, pTile_hash_map);
+}
+
+Enum_StatusCodes ReplaceColorWithHistory(
+    uint8_t from_r, uint8_t from_g, uint8_t from_b, uint8_t to_r, uint8_t to_g,
+    uint8_t to_b, const Struct_TileBounds *pRegion,
+    Struct_EditHistory *pEdit_history, Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t old_value = TILE_VALUE(from_r, from_g, from_b),
+           new_value = TILE_VALUE(to_r, to_g, to_b);
+  Struct_TileBounds region = {.min_x = INT32_MIN,
+                              .min_y = INT32_MIN,
+                              .max_x = INT32_MAX,
+                              .max_y = INT32_MAX};
+  const Struct_TilePalette *palette = &pTile_hash_map->palette;
+
+  if (pRegion) {
+    region = *pRegion;
+  }
+
+  // Only a colour already in the palette can be on tiles the remap skips.
+  for (uint32_t i = 0; i < palette->count && old_value != new_value; i++) {
+    if (TILE_VALUE(palette->colors[i][0], palette->colors[i][1],
+                   palette->colors[i][2]) != new_value) {
+      continue;
+    }
+    // Forks the timeline like RecordTileRunEdit, the deltas go in directly.
+    pEdit_history->count = pEdit_history->applied;
+    uint64_t region_chunks =
+        (uint64_t)((int64_t)(region.max_x >> TILE_CHUNK_SHIFT) -
+                   (region.min_x >> TILE_CHUNK_SHIFT) + 1) *
+        (uint64_t)((int64_t)(region.max_y >> TILE_CHUNK_SHIFT) -
+                   (region.min_y >> TILE_CHUNK_SHIFT) + 1);
+    if (region_chunks > pTile_hash_map->chunk_count) {
+      for (uint32_t j = 0; j < pTile_hash_map->chunk_count; j++) {
+        RecordKeptRuns(pTile_hash_map->chunks[j], &region, i, new_value,
+                       pEdit_history);
+      }
+      break;
+    }
+    for (int64_t chunk_y = region.min_y >> TILE_CHUNK_SHIFT;
+         chunk_y <= region.max_y >> TILE_CHUNK_SHIFT; chunk_y++) {
+      for (int64_t chunk_x = region.min_x >> TILE_CHUNK_SHIFT;
+           chunk_x <= region.max_x >> TILE_CHUNK_SHIFT; chunk_x++) {
+        const Struct_TileChunk *chunk = NULL;
+        AccessTileChunk(chunk_x, chunk_y, pTile_hash_map, &chunk);
+        if (chunk) {
+          RecordKeptRuns(chunk, &region, i, new_value, pEdit_history);
+        }
+      }
+    }
+    break;
+  }
+
+  if ((status = ReplaceTileHashMapColor(from_r, from_g, from_b, to_r, to_g,
+                                        to_b, pRegion, pTile_hash_map)) !=
+      SUCCESS) {
+    return status;
+  }
+  pEdit_history->count = pEdit_history->applied;
+  if (!pEdit_history->group_dropped) {
+    AppendDelta(region.min_x, region.min_y, EDIT_DELTA_REMAP, old_value,
+                new_value, pEdit_history);
+  }
+  if (!pEdit_history->group_dropped) {
+    AppendDelta(region.max_x, region.max_y, EDIT_DELTA_REMAP, old_value,
+                new_value, pEdit_history);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes UndoEdit(Struct_EditHistory *pEdit_history,
+                          Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  const Struct_EditDelta *delta;
+
+  if (!pEdit_history->applied) {
+    return FAILURE;
+  }
+
+  // Newest first, so a tile edited twice in one step ends at its oldest value.
+  BeginTileTransaction(pTile_hash_map);
+  do {
+    delta = GetDelta(pEdit_history, --pEdit_history->applied);
+    if (HAS_FLAG(delta->run, EDIT_DELTA_REMAP)) {
+      const Struct_EditDelta *bottom_right = delta;
+      delta = GetDelta(pEdit_history, --pEdit_history->applied);
+      status |= ApplyColorRemap(delta, bottom_right, 1, pTile_hash_map);
+    }
+    for (uint32_t i = delta->run & EDIT_DELTA_RUN_MASK; i > 0; i--) {
+      status |= ApplyTileValue(delta->x + (int32_t)(i - 1), delta->y,
+                               delta->old_value, pTile_hash_map);
+    }
+  } while (!HAS_FLAG(delta->run, EDIT_DELTA_GROUP_START));
+  CommitTileTransaction(pTile_hash_map);
+  pEdit_history->groups--;
+  BeginEditGroup(pEdit_history);
+
+  return status;
+}
+
+Enum_StatusCodes RedoEdit(Struct_EditHistory *pEdit_history,
+                          Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  const Struct_EditDelta *delta;
+
+  if (pEdit_history->applied == pEdit_history->count) {
+    return FAILURE;
+  }
+
+  BeginTileTransaction(pTile_hash_map);
+  do {
+    delta = GetDelta(pEdit_history, pEdit_history->applied++);
+    if (HAS_FLAG(delta->run, EDIT_DELTA_REMAP)) {
+      status |= ApplyColorRemap(
+          delta, GetDelta(pEdit_history, pEdit_history->applied++), 0,
+          pTile_hash_map);
+    }
+    for (uint32_t i = 0; i < (delta->run & EDIT_DELTA_RUN_MASK); i++) {
+      status |= ApplyTileValue(delta->x + (int32_t)i, delta->y,
+                               delta->new_value, pTile_hash_map);
+    }
+  } while (pEdit_history->applied < pEdit_history->count &&
+           !HAS_FLAG(GetDelta(pEdit_history, pEdit_history->applied)->run,
+                     EDIT_DELTA_GROUP_START));
+  CommitTileTransaction(pTile_hash_map);
+  pEdit_history->groups++;
+  BeginEditGroup(pEdit_history);
+
+  return status;
+}
\ No newline at end of file
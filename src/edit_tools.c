@@ -0,0 +1,629 @@
+#include "../include/edit_tools.h"
+#include <stdlib.h>
+
+#define SPANS_INITIAL_CAPACITY 64
+#define STROKE_INITIAL_CAPACITY 64
+// Side of the square blocks a rotation copies through, keeps both in cache.
+#define ROTATE_BLOCK_SIZE 32
+
+/*
+Growable list of spans, doubles as the seed stack of the flood fill where only
+y and min_x of an entry are used.
+*/
+typedef struct Struct_TileSpanList {
+  Struct_TileSpan *spans;
+  uint32_t count, capacity;
+} Struct_TileSpanList;
+
+/*
+Region being gathered by a flood fill. The map is only written once the whole
+region is known, so the cells gathered so far are set in the occupancy rows of
+a scratch map, which is never committed and so never works out variants.
+*/
+typedef struct Struct_FloodFill {
+  const Struct_TileHashMap *pTile_hash_map;
+  Struct_TileHashMap visited;
+  uint32_t target_value;
+  uint16_t target_index; // Palette index of target_value, unless empty.
+} Struct_FloodFill;
+
+static Enum_StatusCodes QueueStrokeTile(int32_t x, int32_t y,
+                                        Struct_Stroke *pStroke);
+static Enum_StatusCodes PushSpan(Struct_TileSpanList *pSpan_list, int32_t y,
+                                 int32_t min_x, int32_t max_x);
+static uint32_t GetFillableMask(int64_t chunk_x, int32_t y,
+                                const Struct_FloodFill *pFill);
+static void WidenFillSpan(int32_t x, int32_t y, uint64_t area,
+                          uint32_t max_area, const Struct_FloodFill *pFill,
+                          int64_t *pMin_x, int64_t *pMax_x);
+static Enum_StatusCodes PushFillSeeds(int32_t y, int32_t min_x, int32_t max_x,
+                                      const Struct_FloodFill *pFill,
+                                      Struct_TileSpanList *pSeeds);
+static Enum_StatusCodes
+CollectFillSpans(int32_t x, int32_t y, uint32_t max_area,
+                 const Struct_TileHashMap *pTile_hash_map,
+                 Struct_TileSpanList *pSpans);
+static void RecordRectEdit(int32_t min_x, int32_t min_y, int32_t max_x,
+                           int32_t max_y, uint32_t new_value,
+                           Struct_EditHistory *pEdit_history,
+                           const Struct_TileHashMap *pTile_hash_map);
+
+static Enum_StatusCodes QueueStrokeTile(int32_t x, int32_t y,
+                                        Struct_Stroke *pStroke) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if (pStroke->pending_count == pStroke->pending_capacity) {
+    uint32_t capacity = pStroke->pending_capacity
+                            ? pStroke->pending_capacity * 2
+                            : STROKE_INITIAL_CAPACITY;
+    Struct_TileHashNode *pending =
+        realloc(pStroke->pending, capacity * sizeof(Struct_TileHashNode));
+    if (!pending) {
+      status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by QueueStrokeTile()",
+             OUTPUT_LOG_STREAM);
+      return status;
+    }
+    pStroke->pending = pending;
+    pStroke->pending_capacity = capacity;
+  }
+  pStroke->pending[pStroke->pending_count++] = (Struct_TileHashNode){
+      .x = x, .y = y, .r = pStroke->r, .g = pStroke->g, .b = pStroke->b};
+
+  return status;
+}
+
+static Enum_StatusCodes PushSpan(Struct_TileSpanList *pSpan_list, int32_t y,
+                                 int32_t min_x, int32_t max_x) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if (pSpan_list->count == pSpan_list->capacity) {
+    uint32_t capacity = pSpan_list->capacity ? pSpan_list->capacity * 2
+                                             : SPANS_INITIAL_CAPACITY;
+    Struct_TileSpan *spans =
+        realloc(pSpan_list->spans, capacity * sizeof(Struct_TileSpan));
+    if (!spans) {
+      status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by PushSpan()", OUTPUT_LOG_STREAM);
+      return status;
+    }
+    pSpan_list->spans = spans;
+    pSpan_list->capacity = capacity;
+  }
+  pSpan_list->spans[pSpan_list->count++] =
+      (Struct_TileSpan){.y = y, .min_x = min_x, .max_x = max_x};
+
+  return status;
+}
+
+// Cells of row y in the chunk column that hold the target and are not gathered.
+static uint32_t GetFillableMask(int64_t chunk_x, int32_t y,
+                                const Struct_FloodFill *pFill) {
+  int32_t chunk_y = y >> TILE_CHUNK_SHIFT;
+  uint32_t row = y & TILE_CHUNK_MASK, mask = 0;
+  const Struct_TileChunk *chunk = NULL;
+
+  AccessTileChunk(chunk_x, chunk_y, pFill->pTile_hash_map, &chunk);
+  if (pFill->target_value == TILE_VALUE_EMPTY) {
+    mask = chunk ? ~chunk->occupied[row] : UINT32_MAX;
+  } else if (chunk) {
+    const uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+    for (uint32_t col = 0; col < TILE_CHUNK_SIZE; col++) {
+      mask |= (uint32_t)(cells[col] == pFill->target_index) << col;
+    }
+    mask &= chunk->occupied[row];
+  }
+
+  chunk = NULL;
+  AccessTileChunk(chunk_x, chunk_y, &pFill->visited, &chunk);
+
+  return chunk ? mask & ~chunk->occupied[row] : mask;
+}
+
+/*
+Widens the fillable cell (x, y) into its run a chunk row at a time. Widening
+stops once the run would take the area over the limit, an open row would
+never end.
+*/
+static void WidenFillSpan(int32_t x, int32_t y, uint64_t area,
+                          uint32_t max_area, const Struct_FloodFill *pFill,
+                          int64_t *pMin_x, int64_t *pMax_x) {
+  int64_t chunk_x = x >> TILE_CHUNK_SHIFT;
+  uint32_t col = x & TILE_CHUNK_MASK;
+
+  *pMin_x = *pMax_x = x;
+  for (int64_t right_x = chunk_x, right_col = col;; right_x++, right_col = 0) {
+    uint32_t stop =
+        ~GetFillableMask(right_x, y, pFill) & (UINT32_MAX << right_col);
+    if (stop) {
+      *pMax_x = right_x * TILE_CHUNK_SIZE + __builtin_ctz(stop) - 1;
+      break;
+    }
+    *pMax_x = right_x * TILE_CHUNK_SIZE + TILE_CHUNK_MASK;
+    if (*pMax_x >= INT32_MAX || area + (*pMax_x - *pMin_x + 1) > max_area) {
+      return;
+    }
+  }
+  for (int64_t left_x = chunk_x, left_col = col;;
+       left_x--, left_col = TILE_CHUNK_MASK) {
+    uint32_t stop = ~GetFillableMask(left_x, y, pFill) &
+                    (UINT32_MAX >> (TILE_CHUNK_MASK - left_col));
+    if (stop) {
+      *pMin_x =
+          left_x * TILE_CHUNK_SIZE + TILE_CHUNK_SIZE - __builtin_clz(stop);
+      break;
+    }
+    *pMin_x = left_x * TILE_CHUNK_SIZE;
+    if (*pMin_x <= INT32_MIN || area + (*pMax_x - *pMin_x + 1) > max_area) {
+      return;
+    }
+  }
+}
+
+// Pushes the leftmost tile of every fillable run of row y within the bounds.
+static Enum_StatusCodes PushFillSeeds(int32_t y, int32_t min_x, int32_t max_x,
+                                      const Struct_FloodFill *pFill,
+                                      Struct_TileSpanList *pSeeds) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t carry = 0; // Whether the previous chunk's run reaches this one.
+
+  for (int64_t chunk_x = min_x >> TILE_CHUNK_SHIFT;
+       chunk_x <= max_x >> TILE_CHUNK_SHIFT; chunk_x++) {
+    int64_t start_x = chunk_x * TILE_CHUNK_SIZE;
+    int64_t first_col = (min_x > start_x) ? min_x - start_x : 0;
+    int64_t last_col = (max_x - start_x < TILE_CHUNK_MASK) ? max_x - start_x
+                                                           : TILE_CHUNK_MASK;
+    uint32_t mask = GetFillableMask(chunk_x, y, pFill) &
+                    (UINT32_MAX >> (TILE_CHUNK_MASK - last_col)) &
+                    (UINT32_MAX << first_col);
+    uint32_t starts = mask & ~((mask << 1) | carry);
+    carry = mask >> TILE_CHUNK_MASK;
+
+    for (; starts; starts &= starts - 1) {
+      int64_t x = start_x + __builtin_ctz(starts);
+      if ((status = PushSpan(pSeeds, y, x, x)) != SUCCESS) {
+        return status;
+      }
+    }
+  }
+
+  return status;
+}
+
+static Enum_StatusCodes
+CollectFillSpans(int32_t x, int32_t y, uint32_t max_area,
+                 const Struct_TileHashMap *pTile_hash_map,
+                 Struct_TileSpanList *pSpans) {
+  Enum_StatusCodes status = SUCCESS;
+  uint64_t area = 0;
+  Struct_TileSpanList seeds = {0};
+  Struct_FloodFill fill = {.pTile_hash_map = pTile_hash_map,
+                           .target_value = GetTileValue(x, y, pTile_hash_map)};
+
+  if (fill.target_value != TILE_VALUE_EMPTY) {
+    // Colours are interned once, so the index stands for the colour.
+    const Struct_TileChunk *chunk = NULL;
+    AccessTileChunk(x >> TILE_CHUNK_SHIFT, y >> TILE_CHUNK_SHIFT,
+                    pTile_hash_map, &chunk);
+    fill.target_index =
+        chunk->cells[(y & TILE_CHUNK_MASK) * TILE_CHUNK_SIZE +
+                     (x & TILE_CHUNK_MASK)];
+  }
+  if ((status = InitTileHashMap(&fill.visited)) != SUCCESS) {
+    return status;
+  }
+  BeginTileTransaction(&fill.visited);
+  status = PushSpan(&seeds, y, x, x);
+
+  while (status == SUCCESS && seeds.count) {
+    Struct_TileSpan seed = seeds.spans[--seeds.count];
+    if (!HAS_FLAG(GetFillableMask(seed.min_x >> TILE_CHUNK_SHIFT, seed.y,
+                                  &fill),
+                  1U << (seed.min_x & TILE_CHUNK_MASK))) {
+      continue; // Already swallowed by a span found after it was pushed.
+    }
+
+    int64_t min_x, max_x;
+    WidenFillSpan(seed.min_x, seed.y, area, max_area, &fill, &min_x, &max_x);
+    area += max_x - min_x + 1;
+    if (area > max_area) {
+      status = FAILURE;
+      break;
+    }
+    if ((status = PushSpan(pSpans, seed.y, min_x, max_x)) != SUCCESS ||
+        (status = FillTileHashMapRect(min_x, seed.y, max_x, seed.y, 0, 0, 0,
+                                      &fill.visited)) != SUCCESS) {
+      break;
+    }
+
+    if (seed.y > INT32_MIN) {
+      status = PushFillSeeds(seed.y - 1, min_x, max_x, &fill, &seeds);
+    }
+    if (status == SUCCESS && seed.y < INT32_MAX) {
+      status = PushFillSeeds(seed.y + 1, min_x, max_x, &fill, &seeds);
+    }
+  }
+
+  free(seeds.spans);
+  FreeTileHashMap(&fill.visited);
+
+  return status;
+}
+
+/*
+Row major so consecutive equal old values merge into one delta, reading the
+old values straight out of each chunk row rather than looking up every tile.
+*/
+static void RecordRectEdit(int32_t min_x, int32_t min_y, int32_t max_x,
+                           int32_t max_y, uint32_t new_value,
+                           Struct_EditHistory *pEdit_history,
+                           const Struct_TileHashMap *pTile_hash_map) {
+  for (int64_t y = min_y; y <= max_y; y++) {
+    int32_t chunk_y = y >> TILE_CHUNK_SHIFT;
+    uint32_t row = y & TILE_CHUNK_MASK;
+
+    for (int64_t x = min_x; x <= max_x;) {
+      int32_t chunk_x = x >> TILE_CHUNK_SHIFT;
+      int64_t chunk_end = (int64_t)chunk_x * TILE_CHUNK_SIZE + TILE_CHUNK_MASK;
+      const Struct_TileChunk *chunk = NULL;
+      AccessTileChunk(chunk_x, chunk_y, pTile_hash_map, &chunk);
+
+      for (; x <= max_x && x <= chunk_end; x++) {
+        uint32_t col = x & TILE_CHUNK_MASK, old_value = TILE_VALUE_EMPTY;
+        if (chunk && HAS_FLAG(chunk->occupied[row], 1U << col)) {
+          const uint8_t *color =
+              pTile_hash_map->palette
+                  .colors[chunk->cells[row * TILE_CHUNK_SIZE + col]];
+          old_value = TILE_VALUE(color[0], color[1], color[2]);
+        }
+        RecordTileEdit(x, y, old_value, new_value, pEdit_history);
+      }
+    }
+  }
+}
+
+Enum_StatusCodes BeginStroke(int32_t x, int32_t y, uint8_t r, uint8_t g,
+                             uint8_t b, Struct_Stroke *pStroke,
+                             Struct_EditHistory *pEdit_history,
+                             const Struct_TileHashMap *pTile_hash_map) {
+  pStroke->active = 1;
+  pStroke->erasing = GetTileValue(x, y, pTile_hash_map) != TILE_VALUE_EMPTY;
+  pStroke->r = r;
+  pStroke->g = g;
+  pStroke->b = b;
+  pStroke->last_x = x;
+  pStroke->last_y = y;
+  pStroke->pending_count = 0;
+  BeginEditGroup(pEdit_history);
+
+  return QueueStrokeTile(x, y, pStroke);
+}
+
+Enum_StatusCodes ExtendStroke(int32_t x, int32_t y, Struct_Stroke *pStroke) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if (!pStroke->active) {
+    return FAILURE;
+  }
+
+  // Bresenham from the previous sample, which is already queued, to this one.
+  int64_t curr_x = pStroke->last_x, curr_y = pStroke->last_y;
+  int64_t dx = (x > curr_x) ? x - curr_x : curr_x - x;
+  int64_t dy = (y > curr_y) ? curr_y - y : y - curr_y;
+  int64_t step_x = (x > curr_x) ? 1 : -1, step_y = (y > curr_y) ? 1 : -1;
+  int64_t err = dx + dy;
+  while (curr_x != x || curr_y != y) {
+    int64_t err2 = 2 * err;
+    if (err2 >= dy) {
+      err += dy;
+      curr_x += step_x;
+    }
+    if (err2 <= dx) {
+      err += dx;
+      curr_y += step_y;
+    }
+    if ((status = QueueStrokeTile(curr_x, curr_y, pStroke)) != SUCCESS) {
+      return status;
+    }
+  }
+  pStroke->last_x = x;
+  pStroke->last_y = y;
+
+  return status;
+}
+
+Enum_StatusCodes FlushStroke(Struct_Stroke *pStroke,
+                             Struct_EditHistory *pEdit_history,
+                             Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t new_value = pStroke->erasing
+                           ? TILE_VALUE_EMPTY
+                           : TILE_VALUE(pStroke->r, pStroke->g, pStroke->b);
+
+  // The stroke's undo step spans frames, each flush is one map transaction.
+  BeginTileTransaction(pTile_hash_map);
+  for (uint32_t i = 0; i < pStroke->pending_count; i++) {
+    const Struct_TileHashNode *tile = &pStroke->pending[i];
+    RecordTileEdit(tile->x, tile->y,
+                   GetTileValue(tile->x, tile->y, pTile_hash_map), new_value,
+                   pEdit_history);
+    if (pStroke->erasing) {
+      PopTileHashMapEntry(tile->x, tile->y, pTile_hash_map);
+    }
+  }
+  if (!pStroke->erasing) {
+    status = AddTileHashMapEntries(pStroke->pending, pStroke->pending_count, 0,
+                                   pTile_hash_map);
+  }
+  CommitTileTransaction(pTile_hash_map);
+  pStroke->pending_count = 0;
+
+  return status;
+}
+
+Enum_StatusCodes EndStroke(Struct_Stroke *pStroke,
+                           Struct_EditHistory *pEdit_history,
+                           Struct_TileHashMap *pTile_hash_map) {
+  if (!pStroke->active) {
+    return FAILURE;
+  }
+  pStroke->active = 0;
+
+  return FlushStroke(pStroke, pEdit_history, pTile_hash_map);
+}
+
+void FreeStroke(Struct_Stroke *pStroke) {
+  free(pStroke->pending);
+  *pStroke = (Struct_Stroke){0};
+}
+
+Enum_StatusCodes FloodFillTiles(int32_t x, int32_t y, uint8_t r, uint8_t g,
+                                uint8_t b, uint32_t max_area,
+                                Struct_EditHistory *pEdit_history,
+                                Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TileSpanList spans = {0};
+
+  if (GetTileValue(x, y, pTile_hash_map) == TILE_VALUE(r, g, b)) {
+    return FAILURE; // Filling with the colour already there changes nothing.
+  }
+
+  if ((status = CollectFillSpans(x, y, max_area, pTile_hash_map, &spans)) ==
+      SUCCESS) {
+    uint32_t old_value = GetTileValue(x, y, pTile_hash_map);
+    BeginEditTransaction(pEdit_history, pTile_hash_map);
+    for (uint32_t i = 0; i < spans.count && status == SUCCESS; i++) {
+      const Struct_TileSpan *span = &spans.spans[i];
+      if ((status = FillTileHashMapRect(span->min_x, span->y, span->max_x,
+                                        span->y, r, g, b, pTile_hash_map)) ==
+          SUCCESS) {
+        RecordTileRunEdit(span->min_x, span->y,
+                          (int64_t)span->max_x - span->min_x + 1, old_value,
+                          TILE_VALUE(r, g, b), pEdit_history);
+      }
+    }
+    CommitEditTransaction(pEdit_history, pTile_hash_map);
+  }
+  free(spans.spans);
+
+  return status;
+}
+
+Enum_StatusCodes EditTileRect(int32_t x0, int32_t y0, int32_t x1, int32_t y1,
+                              uint8_t erasing, uint8_t r, uint8_t g, uint8_t b,
+                              Struct_EditHistory *pEdit_history,
+                              Struct_TileHashMap *pTile_hash_map) {
+  int32_t min_x = (x0 < x1) ? x0 : x1, max_x = (x0 < x1) ? x1 : x0;
+  int32_t min_y = (y0 < y1) ? y0 : y1, max_y = (y0 < y1) ? y1 : y0;
+  Enum_StatusCodes status = SUCCESS;
+
+  BeginEditTransaction(pEdit_history, pTile_hash_map);
+  RecordRectEdit(min_x, min_y, max_x, max_y,
+                 erasing ? TILE_VALUE_EMPTY : TILE_VALUE(r, g, b),
+                 pEdit_history, pTile_hash_map);
+  status = erasing ? EraseTileHashMapRect(min_x, min_y, max_x, max_y,
+                                          pTile_hash_map)
+                   : FillTileHashMapRect(min_x, min_y, max_x, max_y, r, g, b,
+                                         pTile_hash_map);
+  CommitEditTransaction(pEdit_history, pTile_hash_map);
+
+  return status;
+}
+
+Enum_StatusCodes ReplaceTileColor(int32_t x, int32_t y, uint8_t r, uint8_t g,
+                                  uint8_t b, const Struct_TileBounds *pRegion,
+                                  Struct_EditHistory *pEdit_history,
+                                  Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t old_value = GetTileValue(x, y, pTile_hash_map);
+
+  if (old_value == TILE_VALUE_EMPTY || old_value == TILE_VALUE(r, g, b)) {
+    return FAILURE;
+  }
+
+  BeginEditTransaction(pEdit_history, pTile_hash_map);
+  status = ReplaceColorWithHistory((old_value >> 16) & 0xFF,
+                                   (old_value >> 8) & 0xFF, old_value & 0xFF,
+                                   r, g, b, pRegion, pEdit_history,
+                                   pTile_hash_map);
+  CommitEditTransaction(pEdit_history, pTile_hash_map);
+
+  return status;
+}
+
+Enum_StatusCodes CopyTileRegion(const Struct_TileBounds *pRegion,
+                                const Struct_TileHashMap *pTile_hash_map,
+                                Struct_TileClipboard *pClipboard) {
+  Enum_StatusCodes status = SUCCESS;
+  uint64_t width = (int64_t)pRegion->max_x - pRegion->min_x + 1,
+           height = (int64_t)pRegion->max_y - pRegion->min_y + 1;
+
+  if (pRegion->min_x > pRegion->max_x || pRegion->min_y > pRegion->max_y ||
+      width * height > UINT32_MAX) {
+    return FAILURE;
+  }
+
+  uint32_t *values = malloc(width * height * sizeof(uint32_t));
+  if (!values) {
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by CopyTileRegion()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  ReadTileHashMapBlock(pRegion->min_x, pRegion->min_y, width, height,
+                       pTile_hash_map, values);
+
+  free(pClipboard->values);
+  *pClipboard = (Struct_TileClipboard){
+      .width = width, .height = height, .values = values};
+
+  return status;
+}
+
+Enum_StatusCodes RotateTileClipboard(Struct_TileClipboard *pClipboard) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t width = pClipboard->width, height = pClipboard->height;
+
+  if (!pClipboard->values) {
+    return FAILURE;
+  }
+  uint32_t *rotated = malloc((size_t)width * height * sizeof(uint32_t));
+  if (!rotated) {
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by RotateTileClipboard()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  // (x, y) lands on (height - 1 - y, x) of a clipboard height wide.
+  for (uint32_t block_y = 0; block_y < height; block_y += ROTATE_BLOCK_SIZE) {
+    for (uint32_t block_x = 0; block_x < width;
+         block_x += ROTATE_BLOCK_SIZE) {
+      for (uint32_t y = block_y; y < height && y < block_y + ROTATE_BLOCK_SIZE;
+           y++) {
+        for (uint32_t x = block_x;
+             x < width && x < block_x + ROTATE_BLOCK_SIZE; x++) {
+          rotated[(size_t)x * height + (height - 1 - y)] =
+              pClipboard->values[(size_t)y * width + x];
+        }
+      }
+    }
+  }
+
+  free(pClipboard->values);
+  *pClipboard = (Struct_TileClipboard){
+      .width = height, .height = width, .values = rotated};
+
+  return status;
+}
+
+void FlipTileClipboard(uint8_t vertical, Struct_TileClipboard *pClipboard) {
+  uint32_t width = pClipboard->width, height = pClipboard->height;
+  uint32_t *values = pClipboard->values;
+
+  if (!values) {
+    return;
+  }
+  if (vertical) {
+    for (uint32_t top = 0, bottom = height - 1; top < bottom;
+         top++, bottom--) {
+      for (uint32_t x = 0; x < width; x++) {
+        uint32_t swap = values[(size_t)top * width + x];
+        values[(size_t)top * width + x] = values[(size_t)bottom * width + x];
+        values[(size_t)bottom * width + x] = swap;
+      }
+    }
+    return;
+  }
+  for (uint32_t y = 0; y < height; y++) {
+    uint32_t *row = &values[(size_t)y * width];
+    for (uint32_t left = 0, right = width - 1; left < right; left++, right--) {
+      uint32_t swap = row[left];
+      row[left] = row[right];
+      row[right] = swap;
+    }
+  }
+}
+
+void FreeTileClipboard(Struct_TileClipboard *pClipboard) {
+  free(pClipboard->values);
+  *pClipboard = (Struct_TileClipboard){0};
+}
+
+Enum_StatusCodes BeginPaste(int32_t x, int32_t y,
+                            const Struct_TileClipboard *pClipboard,
+                            Struct_PasteJob *pPaste_job,
+                            Struct_EditHistory *pEdit_history) {
+  if (!pClipboard->values ||
+      (int64_t)x + pClipboard->width - 1 > INT32_MAX ||
+      (int64_t)y + pClipboard->height - 1 > INT32_MAX) {
+    return FAILURE;
+  }
+
+  pPaste_job->active = 1;
+  pPaste_job->x = x;
+  pPaste_job->y = y;
+  pPaste_job->next_row = 0;
+  BeginEditGroup(pEdit_history);
+
+  return SUCCESS;
+}
+
+Enum_StatusCodes StepPaste(uint32_t tile_budget,
+                           const Struct_TileClipboard *pClipboard,
+                           Struct_PasteJob *pPaste_job,
+                           Struct_EditHistory *pEdit_history,
+                           Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t width = pClipboard->width;
+
+  if (!pPaste_job->active) {
+    return status;
+  }
+
+  // Whole rows only, at least one so every step makes progress.
+  uint32_t rows = tile_budget / width;
+  rows = rows ? rows : 1;
+  if (rows > pClipboard->height - pPaste_job->next_row) {
+    rows = pClipboard->height - pPaste_job->next_row;
+  }
+  if ((uint64_t)rows * width > pPaste_job->old_capacity) {
+    uint32_t *old_values = realloc(pPaste_job->old_values,
+                                   (size_t)rows * width * sizeof(uint32_t));
+    if (!old_values) {
+      status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by StepPaste()",
+             OUTPUT_LOG_STREAM);
+      return status;
+    }
+    pPaste_job->old_values = old_values;
+    pPaste_job->old_capacity = rows * width;
+  }
+
+  int32_t y = pPaste_job->y + (int32_t)pPaste_job->next_row;
+  const uint32_t *new_values =
+      &pClipboard->values[(size_t)pPaste_job->next_row * width];
+  ReadTileHashMapBlock(pPaste_job->x, y, width, rows, pTile_hash_map,
+                       pPaste_job->old_values);
+  for (uint32_t row = 0; row < rows; row++) {
+    for (uint32_t col = 0; col < width; col++) {
+      size_t i = (size_t)row * width + col;
+      RecordTileEdit(pPaste_job->x + (int32_t)col, y + (int32_t)row,
+                     pPaste_job->old_values[i], new_values[i], pEdit_history);
+    }
+  }
+  status = WriteTileHashMapBlock(pPaste_job->x, y, width, rows, new_values,
+                                 pTile_hash_map);
+
+  pPaste_job->next_row += rows;
+  if (status != SUCCESS || pPaste_job->next_row == pClipboard->height) {
+    pPaste_job->active = 0;
+  }
+
+  return status;
+}
+
+void FreePasteJob(Struct_PasteJob *pPaste_job) {
+  free(pPaste_job->old_values);
+  *pPaste_job = (Struct_PasteJob){0};
+}
\ No newline at end of file
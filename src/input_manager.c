@@ -14,6 +14,13 @@ Enum_Inputs GetInput(uint32_t *pRecorded_mouse_click_x,
       SET_FLAG(input_flags, MSB);
       *pRecorded_mouse_click_x = event.button.x;
       *pRecorded_mouse_click_y = event.button.y;
+    } else if (event.type == SDL_MOUSEMOTION &&
+               HAS_FLAG(event.motion.state, SDL_BUTTON_LMASK)) {
+      SET_FLAG(input_flags, MOUSE_DRAG);
+      *pRecorded_mouse_click_x = event.motion.x;
+      *pRecorded_mouse_click_y = event.motion.y;
+    } else if (event.type == SDL_MOUSEBUTTONUP) {
+      SET_FLAG(input_flags, MSB_RELEASE);
     } else if (event.type == SDL_MOUSEWHEEL) {
       if (event.wheel.y > 0) {
         SET_FLAG(input_flags, SCROLL_UP);
@@ -31,6 +38,21 @@ Enum_Inputs GetInput(uint32_t *pRecorded_mouse_click_x,
       if (event.key.keysym.sym == SDLK_RETURN) {
         SET_FLAG(input_flags, ENTER);
       }
+      if (HAS_FLAG(event.key.keysym.mod, KMOD_CTRL)) {
+        if (event.key.keysym.sym == SDLK_z) {
+          SET_FLAG(input_flags, UNDO);
+        } else if (event.key.keysym.sym == SDLK_y) {
+          SET_FLAG(input_flags, REDO);
+        } else if (event.key.keysym.sym == SDLK_c) {
+          SET_FLAG(input_flags, COPY);
+        } else if (event.key.keysym.sym == SDLK_x) {
+          SET_FLAG(input_flags, CUT);
+        } else if (event.key.keysym.sym == SDLK_v) {
+          SET_FLAG(input_flags, PASTE);
+        } else if (event.key.keysym.sym == SDLK_e) {
+          SET_FLAG(input_flags, EXPORT);
+        }
+      }
     } else if (event.type == SDL_TEXTINPUT) {
       SET_FLAG(input_flags, event.text.text[0] << INPUT_CHAR_BITMASK);
     }
@@ -4,7 +4,7 @@ static SDL_Rect OUTSIDE_GRID = {
     .x = GRID_WIDTH, .y = 0, .w = APP_WIDTH - GRID_WIDTH, .h = APP_HEIGHT};
 
 static void RenderGrid(SDL_Renderer *renderer,
-                       Struct_TileHashNode **tile_hash_arr,
+                       const Struct_TileLayerState *pTile_layer_state,
                        int32_t move_x_offset, int32_t move_y_offset);
 
 static void
@@ -12,10 +12,9 @@ RenderInputWidgets(SDL_Renderer *renderer,
                    const Struct_InputWidgetState *pInput_widget_state);
 
 static void RenderGrid(SDL_Renderer *renderer,
-                       Struct_TileHashNode **tile_hash_arr,
+                       const Struct_TileLayerState *pTile_layer_state,
                        int32_t move_x_offset, int32_t move_y_offset) {
   SDL_Rect rect = {.w = grid_size, .h = grid_size};
-  Struct_TileHashNode *temp = NULL;
 
   /*
   Using this way, when zooming in, the grid cuts off without covering the
@@ -27,19 +26,44 @@ static void RenderGrid(SDL_Renderer *renderer,
   */
   uint32_t rows = (GRID_HEIGHT / grid_size) + 1,
            cols = (GRID_WIDTH / grid_size) + 1;
+  int32_t grid_w = cols * grid_size, grid_h = rows * grid_size;
 
+  /*
+  Outlining every cell and then filling the occupied ones on top gives the same
+  picture as outlining only the empty cells, since a fill covers its own
+  outline. A cell outline covers both its first and last pixel row and column,
+  so every row and column gets two lines.
+  */
+  SDL_SetRenderDrawColor(renderer, BLACKISH, 255);
   for (uint32_t i = 0; i < rows; i++) {
-    for (uint32_t j = 0; j < cols; j++) {
-      rect.y = i * grid_size;
-      rect.x = j * grid_size;
-      if (AccessTileHashMap(j + move_x_offset, i + move_y_offset, tile_hash_arr,
-                            &temp) == SUCCESS) {
-        SDL_SetRenderDrawColor(renderer, temp->r, temp->g, temp->b, 255);
-        SDL_RenderFillRect(renderer, &rect);
-      } else {
-        SDL_SetRenderDrawColor(renderer, BLACKISH, 255);
-        SDL_RenderDrawRect(renderer, &rect);
-      }
+    int32_t y = i * grid_size;
+    SDL_RenderDrawLine(renderer, 0, y, grid_w - 1, y);
+    SDL_RenderDrawLine(renderer, 0, y + grid_size - 1, grid_w - 1,
+                       y + grid_size - 1);
+  }
+  for (uint32_t j = 0; j < cols; j++) {
+    int32_t x = j * grid_size;
+    SDL_RenderDrawLine(renderer, x, 0, x, grid_h - 1);
+    SDL_RenderDrawLine(renderer, x + grid_size - 1, 0, x + grid_size - 1,
+                       grid_h - 1);
+  }
+
+  // Bottom layer first, so the ones above paint over it.
+  for (uint32_t i = 0; i < pTile_layer_state->count; i++) {
+    const Struct_TileLayer *layer = &pTile_layer_state->layers[i];
+    if (!layer->visible || !layer->tile_hash_map.tile_count) {
+      continue;
+    }
+    Struct_TileRangeIter iter;
+    Struct_TileHashNode tile;
+    InitTileRangeIter(&iter, &layer->tile_hash_map, move_x_offset,
+                      move_y_offset, move_x_offset + (int32_t)cols - 1,
+                      move_y_offset + (int32_t)rows - 1);
+    while (NextTileInRange(&iter, &tile) == SUCCESS) {
+      rect.x = (tile.x - move_x_offset) * grid_size;
+      rect.y = (tile.y - move_y_offset) * grid_size;
+      SDL_SetRenderDrawColor(renderer, tile.r, tile.g, tile.b, 255);
+      SDL_RenderFillRect(renderer, &rect);
     }
   }
 }
@@ -55,12 +79,13 @@ RenderInputWidgets(SDL_Renderer *renderer,
   }
 }
 
-void Render(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
+void Render(SDL_Renderer *renderer,
+            const Struct_TileLayerState *pTile_layer_state,
             const Struct_InputWidgetState *pInput_widget_state,
             int32_t move_x_offset, int32_t move_y_offset) {
   SDL_RenderClear(renderer);
 
-  RenderGrid(renderer, tile_hash_arr, move_x_offset, move_y_offset);
+  RenderGrid(renderer, pTile_layer_state, move_x_offset, move_y_offset);
 
   SDL_SetRenderDrawColor(renderer, WHITISH, 255);
   SDL_RenderFillRect(renderer, &OUTSIDE_GRID);
@@ -2,9 +2,36 @@
 #include "../include/logics.h"
 
 static void HandleTileClicks(uint32_t grid_index_x, uint32_t grid_index_y,
-                             Struct_TileHashNode **tile_hash_arr,
+                             Struct_TileHashMap *pTile_hash_map,
+                             Struct_EditHistory *pEdit_history,
                              Struct_InputWidgetState *pInput_widget_state,
+                             Struct_ToolState *pTool_state,
                              int32_t move_x_offset, int32_t move_y_offset);
+static void HandleToolSelection(Enum_Inputs input_flags,
+                                Struct_ToolState *pTool_state);
+static void HandleLayerSelection(Enum_Inputs input_flags,
+                                 Struct_TileLayerState *pTile_layer_state,
+                                 Struct_ToolState *pTool_state);
+static void HandleToolDrag(Enum_Inputs input_flags,
+                           uint32_t recorded_mouse_click_x,
+                           uint32_t recorded_mouse_click_y,
+                           Struct_TileHashMap *pTile_hash_map,
+                           Struct_EditHistory *pEdit_history,
+                           Struct_InputWidgetState *pInput_widget_state,
+                           Struct_ToolState *pTool_state,
+                           int32_t move_x_offset, int32_t move_y_offset);
+static void HandleEditHistory(Enum_Inputs input_flags,
+                              Struct_TileHashMap *pTile_hash_map,
+                              Struct_EditHistory *pEdit_history);
+static void HandleClipboard(Enum_Inputs input_flags,
+                            Struct_TileHashMap *pTile_hash_map,
+                            Struct_EditHistory *pEdit_history,
+                            Struct_ToolState *pTool_state);
+static void HandleClipboardTransforms(Enum_Inputs input_flags,
+                                      Struct_ToolState *pTool_state);
+static void HandleExport(Enum_Inputs input_flags,
+                         const Struct_TileLayerState *pTile_layer_state,
+                         const Struct_InputWidgetState *pInput_widget_state);
 
 static void HandleInputWidgetClicks(SDL_Renderer *renderer,
                                     Enum_Inputs input_flags,
@@ -20,20 +47,190 @@ static void HandleGridMoving(uint32_t input_flags, int32_t *pMove_x_offset,
                              int32_t *pMove_y_offset);
 
 static void HandleTileClicks(uint32_t grid_index_x, uint32_t grid_index_y,
-                             Struct_TileHashNode **tile_hash_arr,
+                             Struct_TileHashMap *pTile_hash_map,
+                             Struct_EditHistory *pEdit_history,
                              Struct_InputWidgetState *pInput_widget_state,
+                             Struct_ToolState *pTool_state,
                              int32_t move_x_offset, int32_t move_y_offset) {
-  if (PopTileHashMapEntry(grid_index_x + move_x_offset,
-                          grid_index_y + move_y_offset,
-                          tile_hash_arr) == SUCCESS) {
+  if (pTool_state->active_tool == FILL_TOOL) {
+    FloodFillTiles(grid_index_x + move_x_offset, grid_index_y + move_y_offset,
+                   pInput_widget_state->widgets[R_WIDGET_INDEX].Value.int_val,
+                   pInput_widget_state->widgets[G_WIDGET_INDEX].Value.int_val,
+                   pInput_widget_state->widgets[B_WIDGET_INDEX].Value.int_val,
+                   FLOOD_FILL_MAX_AREA, pEdit_history, pTile_hash_map);
     return;
-  } else {
-    AddTileHashMapEntry(
+  }
+  // Recolours within the selection if there is one, otherwise everywhere.
+  if (pTool_state->active_tool == REPLACE_TOOL) {
+    ReplaceTileColor(
         grid_index_x + move_x_offset, grid_index_y + move_y_offset,
         pInput_widget_state->widgets[R_WIDGET_INDEX].Value.int_val,
         pInput_widget_state->widgets[G_WIDGET_INDEX].Value.int_val,
         pInput_widget_state->widgets[B_WIDGET_INDEX].Value.int_val,
-        tile_hash_arr);
+        pTool_state->has_selection ? &pTool_state->selection : NULL,
+        pEdit_history, pTile_hash_map);
+    return;
+  }
+  if (pTool_state->active_tool == RECT_FILL_TOOL ||
+      pTool_state->active_tool == RECT_ERASE_TOOL ||
+      pTool_state->active_tool == SELECT_TOOL) {
+    pTool_state->rect = (Struct_RectDrag){
+        .active = 1,
+        .anchor_x = grid_index_x + move_x_offset,
+        .anchor_y = grid_index_y + move_y_offset,
+        .corner_x = grid_index_x + move_x_offset,
+        .corner_y = grid_index_y + move_y_offset};
+    return;
+  }
+
+  // Pressing on a tile starts erasing, on an empty cell starts painting.
+  BeginStroke(grid_index_x + move_x_offset, grid_index_y + move_y_offset,
+              pInput_widget_state->widgets[R_WIDGET_INDEX].Value.int_val,
+              pInput_widget_state->widgets[G_WIDGET_INDEX].Value.int_val,
+              pInput_widget_state->widgets[B_WIDGET_INDEX].Value.int_val,
+              &pTool_state->stroke, pEdit_history, pTile_hash_map);
+}
+
+static void HandleToolSelection(Enum_Inputs input_flags,
+                                Struct_ToolState *pTool_state) {
+  char keypress = input_flags >> INPUT_CHAR_BITMASK;
+
+  if (keypress == PEN_TOOL_KEY) {
+    pTool_state->active_tool = PEN_TOOL;
+  } else if (keypress == FILL_TOOL_KEY) {
+    pTool_state->active_tool = FILL_TOOL;
+  } else if (keypress == RECT_FILL_TOOL_KEY) {
+    pTool_state->active_tool = RECT_FILL_TOOL;
+  } else if (keypress == RECT_ERASE_TOOL_KEY) {
+    pTool_state->active_tool = RECT_ERASE_TOOL;
+  } else if (keypress == SELECT_TOOL_KEY) {
+    pTool_state->active_tool = SELECT_TOOL;
+  } else if (keypress == REPLACE_TOOL_KEY) {
+    pTool_state->active_tool = REPLACE_TOOL;
+  }
+}
+
+static void HandleLayerSelection(Enum_Inputs input_flags,
+                                 Struct_TileLayerState *pTile_layer_state,
+                                 Struct_ToolState *pTool_state) {
+  char keypress = input_flags >> INPUT_CHAR_BITMASK;
+  Struct_TileLayer *layer = GetActiveTileLayer(pTile_layer_state);
+
+  if (keypress == TOGGLE_LAYER_KEY) {
+    layer->visible = !layer->visible;
+  } else if (keypress == NEXT_LAYER_KEY || keypress == PREVIOUS_LAYER_KEY) {
+    // A stroke still held down belongs to the layer it was started on.
+    EndStroke(&pTool_state->stroke, &layer->edit_history,
+              &layer->tile_hash_map);
+    pTile_layer_state->active =
+        (pTile_layer_state->active +
+         ((keypress == NEXT_LAYER_KEY) ? 1 : pTile_layer_state->count - 1)) %
+        pTile_layer_state->count;
+  }
+}
+
+static void HandleToolDrag(Enum_Inputs input_flags,
+                           uint32_t recorded_mouse_click_x,
+                           uint32_t recorded_mouse_click_y,
+                           Struct_TileHashMap *pTile_hash_map,
+                           Struct_EditHistory *pEdit_history,
+                           Struct_InputWidgetState *pInput_widget_state,
+                           Struct_ToolState *pTool_state,
+                           int32_t move_x_offset, int32_t move_y_offset) {
+  Struct_RectDrag *rect = &pTool_state->rect;
+
+  if (HAS_FLAG(input_flags, MOUSE_DRAG) &&
+      recorded_mouse_click_x <= GRID_WIDTH) {
+    uint32_t grid_x_index, grid_y_index;
+    GetGridIndex(recorded_mouse_click_x, recorded_mouse_click_y,
+                 &grid_x_index, &grid_y_index);
+    ExtendStroke(grid_x_index + move_x_offset, grid_y_index + move_y_offset,
+                 &pTool_state->stroke);
+    rect->corner_x = grid_x_index + move_x_offset;
+    rect->corner_y = grid_y_index + move_y_offset;
+  } else if (HAS_FLAG(input_flags, MSB_RELEASE)) {
+    EndStroke(&pTool_state->stroke, pEdit_history, pTile_hash_map);
+    // The rectangle is only used once, when the button comes back up.
+    if (rect->active && pTool_state->active_tool == SELECT_TOOL) {
+      rect->active = 0;
+      pTool_state->has_selection = 1;
+      pTool_state->selection = (Struct_TileBounds){
+          .min_x = (rect->anchor_x < rect->corner_x) ? rect->anchor_x
+                                                     : rect->corner_x,
+          .min_y = (rect->anchor_y < rect->corner_y) ? rect->anchor_y
+                                                     : rect->corner_y,
+          .max_x = (rect->anchor_x < rect->corner_x) ? rect->corner_x
+                                                     : rect->anchor_x,
+          .max_y = (rect->anchor_y < rect->corner_y) ? rect->corner_y
+                                                     : rect->anchor_y};
+    } else if (rect->active) {
+      rect->active = 0;
+      EditTileRect(rect->anchor_x, rect->anchor_y, rect->corner_x,
+                   rect->corner_y, pTool_state->active_tool == RECT_ERASE_TOOL,
+                   pInput_widget_state->widgets[R_WIDGET_INDEX].Value.int_val,
+                   pInput_widget_state->widgets[G_WIDGET_INDEX].Value.int_val,
+                   pInput_widget_state->widgets[B_WIDGET_INDEX].Value.int_val,
+                   pEdit_history, pTile_hash_map);
+    }
+  }
+}
+
+static void HandleEditHistory(Enum_Inputs input_flags,
+                              Struct_TileHashMap *pTile_hash_map,
+                              Struct_EditHistory *pEdit_history) {
+  if (HAS_FLAG(input_flags, UNDO)) {
+    UndoEdit(pEdit_history, pTile_hash_map);
+  } else if (HAS_FLAG(input_flags, REDO)) {
+    RedoEdit(pEdit_history, pTile_hash_map);
+  }
+}
+
+// Pastes land on the top left of the selection.
+static void HandleClipboard(Enum_Inputs input_flags,
+                            Struct_TileHashMap *pTile_hash_map,
+                            Struct_EditHistory *pEdit_history,
+                            Struct_ToolState *pTool_state) {
+  const Struct_TileBounds *selection = &pTool_state->selection;
+
+  if (!pTool_state->has_selection) {
+    return;
+  }
+  if (HAS_FLAG(input_flags, COPY | CUT)) {
+    if (CopyTileRegion(selection, pTile_hash_map, &pTool_state->clipboard) ==
+            SUCCESS &&
+        HAS_FLAG(input_flags, CUT)) {
+      EditTileRect(selection->min_x, selection->min_y, selection->max_x,
+                   selection->max_y, 1, 0, 0, 0, pEdit_history,
+                   pTile_hash_map);
+    }
+  } else if (HAS_FLAG(input_flags, PASTE)) {
+    BeginPaste(selection->min_x, selection->min_y, &pTool_state->clipboard,
+               &pTool_state->paste, pEdit_history);
+  }
+}
+
+// The map itself is saved on exit, this only writes the text copy.
+static void HandleExport(Enum_Inputs input_flags,
+                         const Struct_TileLayerState *pTile_layer_state,
+                         const Struct_InputWidgetState *pInput_widget_state) {
+  if (HAS_FLAG(input_flags, EXPORT)) {
+    DumpLayersToFile(
+        pTile_layer_state, OBJ_FILE_TO_EXPORT,
+        (uint32_t)pInput_widget_state->widgets[TILE_SIZE_WIDGET_INDEX]
+            .Value.int_val);
+  }
+}
+
+static void HandleClipboardTransforms(Enum_Inputs input_flags,
+                                      Struct_ToolState *pTool_state) {
+  char keypress = input_flags >> INPUT_CHAR_BITMASK;
+
+  if (keypress == ROTATE_CLIPBOARD_KEY) {
+    RotateTileClipboard(&pTool_state->clipboard);
+  } else if (keypress == FLIP_CLIPBOARD_X_KEY) {
+    FlipTileClipboard(0, &pTool_state->clipboard);
+  } else if (keypress == FLIP_CLIPBOARD_Y_KEY) {
+    FlipTileClipboard(1, &pTool_state->clipboard);
   }
 }
 
@@ -51,7 +248,7 @@ static void HandleInputWidgetClicks(SDL_Renderer *renderer,
   char keypress = input_flags >> INPUT_CHAR_BITMASK;
   int32_t int_val = 0;
   char str_val[WIDGET_CHARACTER_LIMIT];
-  int32_t str_val_len;
+  int32_t str_val_len = 0;
 
   if (pInput_widget->ValueType == INT) {
     int_val = pInput_widget->Value.int_val;
@@ -145,17 +342,39 @@ static void HandleGridMoving(uint32_t input_flags, int32_t *pMove_x_offset,
   }
 }
 
-void HandleState(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
+void HandleState(SDL_Renderer *renderer,
+                 Struct_TileLayerState *pTile_layer_state,
                  Struct_InputWidgetState *pInput_widget_state,
-                 Enum_Inputs input_flags, int32_t *pMove_x_offset,
-                 int32_t *pMove_y_offset, uint32_t *pRecorded_mouse_click_x,
+                 Struct_ToolState *pTool_state, Enum_Inputs input_flags,
+                 int32_t *pMove_x_offset, int32_t *pMove_y_offset,
+                 uint32_t *pRecorded_mouse_click_x,
                  uint32_t *pRecorded_mouse_click_y, uint32_t *pCurrent_time) {
+  Struct_TileLayer *layer = GetActiveTileLayer(pTile_layer_state);
+
+  /*
+  Anything that could edit the map, the clipboard or the active layer, or
+  export it, lets a paste land first.
+  */
+  if (HAS_FLAG(input_flags,
+               MSB | UNDO | REDO | COPY | CUT | PASTE | EXPORT) ||
+      input_flags >> INPUT_CHAR_BITMASK) {
+    StepPaste(UINT32_MAX, &pTool_state->clipboard, &pTool_state->paste,
+              &layer->edit_history, &layer->tile_hash_map);
+  }
+  if (!pInput_widget_state->selected) {
+    HandleLayerSelection(input_flags, pTile_layer_state, pTool_state);
+    layer = GetActiveTileLayer(pTile_layer_state);
+  }
+  Struct_TileHashMap *pTile_hash_map = &layer->tile_hash_map;
+  Struct_EditHistory *pEdit_history = &layer->edit_history;
+
   if (HAS_FLAG(input_flags, MSB) && *pRecorded_mouse_click_x <= GRID_WIDTH) {
     uint32_t grid_x_index, grid_y_index;
     GetGridIndex(*pRecorded_mouse_click_x, *pRecorded_mouse_click_y,
                  &grid_x_index, &grid_y_index);
-    HandleTileClicks(grid_x_index, grid_y_index, tile_hash_arr,
-                     pInput_widget_state, *pMove_x_offset, *pMove_y_offset);
+    HandleTileClicks(grid_x_index, grid_y_index, pTile_hash_map,
+                     pEdit_history, pInput_widget_state, pTool_state,
+                     *pMove_x_offset, *pMove_y_offset);
   } else if ((HAS_FLAG(input_flags, MSB) &&
               *pRecorded_mouse_click_x > GRID_WIDTH) ||
              pInput_widget_state->selected) {
@@ -163,6 +382,17 @@ void HandleState(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
                            pRecorded_mouse_click_x, pRecorded_mouse_click_y);
   }
 
+  HandleToolDrag(input_flags, *pRecorded_mouse_click_x,
+                 *pRecorded_mouse_click_y, pTile_hash_map, pEdit_history,
+                 pInput_widget_state, pTool_state, *pMove_x_offset,
+                 *pMove_y_offset);
+  if (!pInput_widget_state->selected) {
+    HandleToolSelection(input_flags, pTool_state);
+    HandleClipboardTransforms(input_flags, pTool_state);
+  }
+  HandleEditHistory(input_flags, pTile_hash_map, pEdit_history);
+  HandleClipboard(input_flags, pTile_hash_map, pEdit_history, pTool_state);
+  HandleExport(input_flags, pTile_layer_state, pInput_widget_state);
   HandleGridSize(input_flags);
 
   // This means we are not currently editing rgb and input delay is covered.
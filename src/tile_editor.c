@@ -3,39 +3,63 @@
 
 static Enum_StatusCodes InitApp(SDL_Window **pWindow, SDL_Renderer **pRenderer,
                                 TTF_Font **pFont,
-                                Struct_TileHashNode ***pTile_hash_arr,
+                                Struct_TileLayerState *pTile_layer_state,
                                 Struct_InputWidgetState *pInput_widget_state);
-static void AppLoop(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
+static void AppLoop(SDL_Renderer *renderer,
+                    Struct_TileLayerState *pTile_layer_state,
                     Struct_InputWidgetState *pInput_widget_state);
-static void ExitApp(SDL_Window **pWindow, SDL_Renderer **pRenderer,
-                    TTF_Font **pFont, Struct_TileHashNode ***pTile_hash_arr,
+static void ExitApp(Enum_StatusCodes init_status, SDL_Window **pWindow,
+                    SDL_Renderer **pRenderer, TTF_Font **pFont,
+                    Struct_TileLayerState *pTile_layer_state,
                     Struct_InputWidgetState *pInput_widget_state);
 
 static Enum_StatusCodes InitApp(SDL_Window **pWindow, SDL_Renderer **pRenderer,
                                 TTF_Font **pFont,
-                                Struct_TileHashNode ***pTile_hash_arr,
+                                Struct_TileLayerState *pTile_layer_state,
                                 Struct_InputWidgetState *pInput_widget_state) {
   if (InitSDL(pWindow, pRenderer) != SUCCESS || InitTTF(pFont) != SUCCESS ||
-      InitTileHashMap(pTile_hash_arr) != SUCCESS ||
+      InitTileLayerState(pTile_layer_state, EDIT_HISTORY_BUDGET) !=
+          SUCCESS ||
       InitInputWidgetState(pInput_widget_state, *pRenderer, *pFont) !=
           SUCCESS) {
     return FAILURE;
   }
 
-  if (ParseFileToData(
-          *pTile_hash_arr, FILE_TO_WORK_ON,
-          (uint32_t)pInput_widget_state->widgets[TILE_SIZE_WIDGET_INDEX]
-              .Value.int_val)) {
+  /*
+  The binary map is the working file. Until it is first saved the map comes
+  from the OBJ, which is how maps from before it carry over.
+  */
+  FILE *map_file = fopen(FILE_TO_WORK_ON, "rb");
+  if (!map_file) {
+    return ParseFileToLayers(
+               pTile_layer_state, OBJ_FILE_TO_EXPORT,
+               (uint32_t)pInput_widget_state->widgets[TILE_SIZE_WIDGET_INDEX]
+                   .Value.int_val)
+               ? FAILURE
+               : SUCCESS;
+  }
+  fclose(map_file);
+
+  uint32_t tile_size;
+  if (ParseBinaryToLayers(pTile_layer_state, FILE_TO_WORK_ON, &tile_size)) {
+    return FAILURE;
+  }
+  // The export keeps scaling tiles by what the map was saved with.
+  int32_t tile_size_val = tile_size;
+  if (EditInputWidget(&pInput_widget_state->widgets[TILE_SIZE_WIDGET_INDEX],
+                      *pRenderer, NULL, &tile_size_val)) {
     return FAILURE;
   }
 
   return SUCCESS;
 }
 
-static void AppLoop(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
+static void AppLoop(SDL_Renderer *renderer,
+                    Struct_TileLayerState *pTile_layer_state,
                     Struct_InputWidgetState *pInput_widget_state) {
   uint32_t recorded_mouse_click_x = 0, recorded_mouse_click_y = 0;
   int32_t move_x_offset = 0, move_y_offset = 0;
+  Struct_ToolState tool_state = {.active_tool = PEN_TOOL};
 
   uint32_t current_time = SDL_GetTicks();
   Enum_Inputs input_flags = 0;
@@ -43,26 +67,54 @@ static void AppLoop(SDL_Renderer *renderer, Struct_TileHashNode **tile_hash_arr,
   while (1) {
     input_flags = GetInput(&recorded_mouse_click_x, &recorded_mouse_click_y);
     if (HAS_FLAG(input_flags, QUIT)) {
+      // A stroke still held down or a paste half way is kept, not dropped.
+      Struct_TileLayer *layer = GetActiveTileLayer(pTile_layer_state);
+      EndStroke(&tool_state.stroke, &layer->edit_history,
+                &layer->tile_hash_map);
+      StepPaste(UINT32_MAX, &tool_state.clipboard, &tool_state.paste,
+                &layer->edit_history, &layer->tile_hash_map);
+      FreeStroke(&tool_state.stroke);
+      FreePasteJob(&tool_state.paste);
+      FreeTileClipboard(&tool_state.clipboard);
       return;
     }
-    HandleState(renderer, tile_hash_arr, pInput_widget_state, input_flags,
-                &move_x_offset, &move_y_offset, &recorded_mouse_click_x,
-                &recorded_mouse_click_y, &current_time);
+    HandleState(renderer, pTile_layer_state, pInput_widget_state, &tool_state,
+                input_flags, &move_x_offset, &move_y_offset,
+                &recorded_mouse_click_x, &recorded_mouse_click_y,
+                &current_time);
     if (SDL_GetTicks() - current_time >= FRAME_DELAY) {
-      Render(renderer, tile_hash_arr, pInput_widget_state, move_x_offset,
+      /*
+      Everything a held stroke covered since the last frame, in one batch.
+      Switching layers ends strokes and pastes first, so both are still on the
+      active layer.
+      */
+      Struct_TileLayer *layer = GetActiveTileLayer(pTile_layer_state);
+      FlushStroke(&tool_state.stroke, &layer->edit_history,
+                  &layer->tile_hash_map);
+      StepPaste(PASTE_TILES_PER_FRAME, &tool_state.clipboard, &tool_state.paste,
+                &layer->edit_history, &layer->tile_hash_map);
+      Render(renderer, pTile_layer_state, pInput_widget_state, move_x_offset,
              move_y_offset);
     }
   }
 }
 
-static void ExitApp(SDL_Window **pWindow, SDL_Renderer **pRenderer,
-                    TTF_Font **pFont, Struct_TileHashNode ***pTile_hash_arr,
+static void ExitApp(Enum_StatusCodes init_status, SDL_Window **pWindow,
+                    SDL_Renderer **pRenderer, TTF_Font **pFont,
+                    Struct_TileLayerState *pTile_layer_state,
                     Struct_InputWidgetState *pInput_widget_state) {
-  // If dumping fails, its way before the file was even opend, so no data loss.
-  DumpDataToFile(*pTile_hash_arr, FILE_TO_WORK_ON,
-                 (uint32_t)pInput_widget_state->widgets[TILE_SIZE_WIDGET_INDEX]
-                     .Value.int_val);
-  FreeTileHashMap(pTile_hash_arr);
+  /*
+  After a failed start the layers hold at most part of the map, saving them
+  would replace the file that could not be read with that part. The save
+  itself only replaces the file once it is complete.
+  */
+  if (init_status == SUCCESS) {
+    DumpLayersToBinary(
+        pTile_layer_state, FILE_TO_WORK_ON,
+        (uint32_t)pInput_widget_state->widgets[TILE_SIZE_WIDGET_INDEX]
+            .Value.int_val);
+  }
+  FreeTileLayerState(pTile_layer_state);
 
   ExitInputWidgetState(pInput_widget_state);
 
@@ -74,12 +126,15 @@ void App(void) {
   SDL_Window *window = NULL;
   SDL_Renderer *renderer = NULL;
   TTF_Font *font = NULL;
-  Struct_TileHashNode **tile_hash_arr = NULL;
+  Struct_TileLayerState tile_layer_state = {0};
   Struct_InputWidgetState input_widget_state;
 
-  if (InitApp(&window, &renderer, &font, &tile_hash_arr, &input_widget_state) ==
-      SUCCESS) {
-    AppLoop(renderer, tile_hash_arr, &input_widget_state);
+  Enum_StatusCodes init_status = InitApp(&window, &renderer, &font,
+                                         &tile_layer_state,
+                                         &input_widget_state);
+  if (init_status == SUCCESS) {
+    AppLoop(renderer, &tile_layer_state, &input_widget_state);
   }
-  ExitApp(&window, &renderer, &font, &tile_hash_arr, &input_widget_state);
+  ExitApp(init_status, &window, &renderer, &font, &tile_layer_state,
+          &input_widget_state);
 }
\ No newline at end of file
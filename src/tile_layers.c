@@ -0,0 +1,355 @@
+#include "../include/tile_layers.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Binary sections are written in large pieces, a big buffer saves most calls.
+#define BINARY_WRITE_BUFFER_SIZE (1024 * 1024)
+
+static Enum_StatusCodes
+DumpLayersBinaryStream(const Struct_TileLayerState *pTile_layer_state,
+                       FILE *file, uint32_t tile_size);
+static Enum_StatusCodes
+ParseLayersBinaryData(Struct_TileLayerState *pTile_layer_state,
+                      const uint8_t *data, const uint8_t *end,
+                      uint32_t *pTile_size);
+
+static Enum_StatusCodes
+DumpLayersBinaryStream(const Struct_TileLayerState *pTile_layer_state,
+                       FILE *file, uint32_t tile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TileLayersBinaryHeader header = {
+      .version = TILE_LAYERS_BINARY_VERSION,
+      .byte_order = TILE_LAYERS_BINARY_BYTE_ORDER,
+      .tile_size = tile_size,
+      .layer_count = pTile_layer_state->count};
+
+  memcpy(header.magic, TILE_LAYERS_BINARY_MAGIC, sizeof(header.magic));
+  for (uint32_t i = 0; i < pTile_layer_state->count; i++) {
+    header.tile_count += pTile_layer_state->layers[i].tile_hash_map.tile_count;
+  }
+  if ((status = WriteBinary(&header, sizeof(header), file)) != SUCCESS) {
+    Logger(&status, NULL, "Error produced by DumpLayersBinaryStream()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  status = DumpStringPoolBinary(&pTile_layer_state->strings, file);
+
+  // Empty layers are kept too, they cost a few words and keep the layer order.
+  for (uint32_t i = 0; i < pTile_layer_state->count && status == SUCCESS;
+       i++) {
+    const Struct_TileLayer *layer = &pTile_layer_state->layers[i];
+    if ((status = WriteBinary(layer->name, sizeof(layer->name), file)) !=
+        SUCCESS) {
+      Logger(&status, NULL, "Error produced by DumpLayersBinaryStream()",
+             OUTPUT_LOG_STREAM);
+    } else if ((status = DumpTileHashMapBinary(&layer->tile_hash_map,
+                                               file)) == SUCCESS) {
+      status = DumpTilePropertiesBinary(&layer->properties, file);
+    }
+  }
+
+  return status;
+}
+
+static Enum_StatusCodes
+ParseLayersBinaryData(Struct_TileLayerState *pTile_layer_state,
+                      const uint8_t *data, const uint8_t *end,
+                      uint32_t *pTile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TileLayersBinaryHeader header;
+  Struct_TilePropertyLoader loader = {0};
+  const uint8_t *cursor = data;
+
+  if (ReadBinary(&header, sizeof(header), &cursor, end) != SUCCESS ||
+      memcmp(header.magic, TILE_LAYERS_BINARY_MAGIC, sizeof(header.magic)) ||
+      header.version != TILE_LAYERS_BINARY_VERSION ||
+      header.byte_order != TILE_LAYERS_BINARY_BYTE_ORDER ||
+      !header.tile_size || header.tile_size > INT32_MAX ||
+      header.layer_count > MAX_TILE_LAYERS) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by ParseLayersBinaryData()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  status = LoadStringPoolBinary(&cursor, end, &loader,
+                                &pTile_layer_state->strings);
+
+  for (uint32_t i = 0; i < header.layer_count && status == SUCCESS; i++) {
+    const void *name_data;
+    char layer_name[TILE_LAYER_NAME_LIMIT];
+    uint32_t index;
+
+    if (MapBinary(&name_data, TILE_LAYER_NAME_LIMIT, &cursor, end) !=
+        SUCCESS) {
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by ParseLayersBinaryData()",
+             OUTPUT_LOG_STREAM);
+      break;
+    }
+    // Saved names are terminated, this only guards against corrupt ones.
+    snprintf(layer_name, sizeof(layer_name), "%.*s",
+             TILE_LAYER_NAME_LIMIT - 1, (const char *)name_data);
+    if (FindTileLayer(layer_name, pTile_layer_state, &index) != SUCCESS &&
+        (status = AddTileLayer(layer_name, pTile_layer_state, &index)) !=
+            SUCCESS) {
+      break;
+    }
+
+    Struct_TileLayer *layer = &pTile_layer_state->layers[index];
+    if ((status = LoadTileHashMapBinary(&cursor, end,
+                                        &layer->tile_hash_map)) == SUCCESS) {
+      status = LoadTilePropertiesBinary(&cursor, end, &loader,
+                                        &layer->properties);
+    }
+  }
+  FreeTilePropertyLoader(&loader);
+  if (status == SUCCESS) {
+    *pTile_size = header.tile_size;
+  }
+
+  return status;
+}
+
+Enum_StatusCodes
+InitTileLayerState(Struct_TileLayerState *pTile_layer_state,
+                   size_t history_budget) {
+  Enum_StatusCodes status = SUCCESS;
+  const char *default_names[] = DEFAULT_TILE_LAYERS;
+  uint32_t index;
+
+  *pTile_layer_state =
+      (Struct_TileLayerState){.history_budget = history_budget};
+  InitStringPool(&pTile_layer_state->strings);
+  for (uint32_t i = 0;
+       i < sizeof(default_names) / sizeof(default_names[0]); i++) {
+    if ((status = AddTileLayer(default_names[i], pTile_layer_state,
+                               &index)) != SUCCESS) {
+      return status;
+    }
+  }
+
+  return status;
+}
+
+void FreeTileLayerState(Struct_TileLayerState *pTile_layer_state) {
+  for (uint32_t i = 0; i < pTile_layer_state->count; i++) {
+    FreeTileHashMap(&pTile_layer_state->layers[i].tile_hash_map);
+    FreeEditHistory(&pTile_layer_state->layers[i].edit_history);
+    FreeTilePropertyTable(&pTile_layer_state->layers[i].properties);
+  }
+  FreeStringPool(&pTile_layer_state->strings);
+  pTile_layer_state->count = 0;
+  pTile_layer_state->active = 0;
+}
+
+Enum_StatusCodes AddTileLayer(const char *name,
+                              Struct_TileLayerState *pTile_layer_state,
+                              uint32_t *pIndex) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if (pTile_layer_state->count == MAX_TILE_LAYERS) {
+    status = INVALID_FUNCTION_INPUT | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by AddTileLayer()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  Struct_TileLayer *layer =
+      &pTile_layer_state->layers[pTile_layer_state->count];
+  *layer = (Struct_TileLayer){.visible = 1};
+  snprintf(layer->name, sizeof(layer->name), "%s", name);
+  if ((status = InitTileHashMap(&layer->tile_hash_map)) != SUCCESS) {
+    return status;
+  }
+  if ((status = InitEditHistory(&layer->edit_history,
+                                pTile_layer_state->history_budget)) !=
+      SUCCESS) {
+    FreeTileHashMap(&layer->tile_hash_map);
+    return status;
+  }
+  InitTilePropertyTable(&layer->properties);
+  *pIndex = pTile_layer_state->count++;
+
+  return status;
+}
+
+Enum_StatusCodes
+FindTileLayer(const char *name,
+              const Struct_TileLayerState *pTile_layer_state,
+              uint32_t *pIndex) {
+  for (uint32_t i = 0; i < pTile_layer_state->count; i++) {
+    if (!strcmp(pTile_layer_state->layers[i].name, name)) {
+      *pIndex = i;
+      return SUCCESS;
+    }
+  }
+
+  return FAILURE;
+}
+
+Struct_TileLayer *
+GetActiveTileLayer(Struct_TileLayerState *pTile_layer_state) {
+  return &pTile_layer_state->layers[pTile_layer_state->active];
+}
+
+Enum_StatusCodes
+DumpLayersToFile(const Struct_TileLayerState *pTile_layer_state,
+                 const char *file_path, uint32_t tile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  int32_t vert_c = 0;
+
+  // One flag per string, so strings shared between layers are written once.
+  uint8_t *string_written =
+      calloc(pTile_layer_state->strings.count + 1, sizeof(uint8_t));
+  if (!string_written) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by DumpLayersToFile()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  Struct_TextWriter writer;
+  if ((status = OpenTextWriter(file_path, &writer)) != SUCCESS) {
+    free(string_written);
+    return status;
+  }
+
+  for (uint32_t i = 0; i < pTile_layer_state->count; i++) {
+    const Struct_TileLayer *layer = &pTile_layer_state->layers[i];
+    if (!layer->tile_hash_map.tile_count && !layer->properties.count) {
+      continue;
+    }
+    WriteText(&writer, "o ", 2);
+    WriteText(&writer, layer->name, strlen(layer->name));
+    WriteText(&writer, "\n", 1);
+    DumpDataToText(&layer->tile_hash_map, &writer, tile_size, &vert_c);
+    DumpTilePropertiesToText(&layer->properties, &pTile_layer_state->strings,
+                             &writer, string_written);
+  }
+  free(string_written);
+
+  return CloseTextWriter(&writer);
+}
+
+Enum_StatusCodes
+ParseFileToLayers(Struct_TileLayerState *pTile_layer_state,
+                  const char *file_path, uint32_t tile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TilePropertyLoader loader = {0};
+  Struct_ParsedText parsed;
+  const void *data;
+  size_t size, line_length;
+  const char *line;
+  uint32_t index = 0;
+
+  if ((status = MapFile(file_path, &data, &size)) != SUCCESS || !size) {
+    return status;
+  }
+
+  // The map hands back every line that is not a tile, those are read here.
+  ParseTextInParallel(data, (const char *)data + size, tile_size, &parsed);
+  while ((status = MergeParsedText(
+              &parsed, &pTile_layer_state->layers[index].tile_hash_map, &line,
+              &line_length)) == SUCCESS &&
+         line_length) {
+    if (line_length >= 2 && line[0] == 'o' && line[1] == ' ') {
+      char layer_name[TILE_LAYER_NAME_LIMIT];
+      // Longer names are cut short, as AddTileLayer would do.
+      snprintf(layer_name, sizeof(layer_name), "%.*s",
+               (int32_t)((line_length - 2 < TILE_LAYER_NAME_LIMIT)
+                             ? line_length - 2
+                             : TILE_LAYER_NAME_LIMIT - 1),
+               &line[2]);
+      if (FindTileLayer(layer_name, pTile_layer_state, &index) != SUCCESS &&
+          (status = AddTileLayer(layer_name, pTile_layer_state, &index)) !=
+              SUCCESS) {
+        break;
+      }
+    } else if (line_length >= 2 && (line[0] == 's' || line[0] == 'p') &&
+               line[1] == ' ') {
+      // Property lines are rare, they get a terminated copy of their own.
+      char property_line[TILE_PROPERTY_LINE_SIZE];
+      if (line_length >= sizeof(property_line)) {
+        status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+        Logger(&status, NULL, "Error produced by ParseFileToLayers()",
+               OUTPUT_LOG_STREAM);
+        break;
+      }
+      memcpy(property_line, line, line_length);
+      property_line[line_length] = '\0';
+      if ((status = ParseTilePropertyLine(
+               property_line, &loader, &pTile_layer_state->strings,
+               &pTile_layer_state->layers[index].properties)) != SUCCESS) {
+        break;
+      }
+    }
+  }
+  FreeParsedText(&parsed);
+  UnmapFile(data, size);
+  FreeTilePropertyLoader(&loader);
+
+  return status;
+}
+
+Enum_StatusCodes
+DumpLayersToBinary(const Struct_TileLayerState *pTile_layer_state,
+                   const char *file_path, uint32_t tile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  char temp_path[FILENAME_MAX];
+
+  /*
+  Written next to the file and renamed over it once complete, this is the only
+  copy of the map, so a failed save must leave the previous one in place.
+  */
+  int32_t length = snprintf(temp_path, sizeof(temp_path), "%s.tmp", file_path);
+  FILE *file = (length < 0 || (size_t)length >= sizeof(temp_path))
+                   ? NULL
+                   : fopen(temp_path, "wb");
+  if (!file) {
+    status = INVALID_FILE_PATH | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by DumpLayersToBinary()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  setvbuf(file, NULL, _IOFBF, BINARY_WRITE_BUFFER_SIZE);
+
+  status = DumpLayersBinaryStream(pTile_layer_state, file, tile_size);
+  if (fclose(file) && status == SUCCESS) {
+    status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by DumpLayersToBinary()",
+           OUTPUT_LOG_STREAM);
+  }
+  if (status == SUCCESS && rename(temp_path, file_path)) {
+    status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by DumpLayersToBinary()",
+           OUTPUT_LOG_STREAM);
+  }
+  if (status != SUCCESS) {
+    remove(temp_path);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes
+ParseBinaryToLayers(Struct_TileLayerState *pTile_layer_state,
+                    const char *file_path, uint32_t *pTile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  const void *data;
+  size_t size;
+
+  if ((status = MapFile(file_path, &data, &size)) != SUCCESS) {
+    return status;
+  }
+  if (!size) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by ParseBinaryToLayers()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  status = ParseLayersBinaryData(pTile_layer_state, data,
+                                 (const uint8_t *)data + size, pTile_size);
+  UnmapFile(data, size);
+
+  return status;
+}
\ No newline at end of file
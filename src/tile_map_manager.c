@@ -1,254 +1,3019 @@
 #include "../include/tile_map_manager.h"
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-#define KNUTHS_X_MULTIPLIER 2654435761U
-#define KNUTHS_Y_MULTIPLIER 2246822519U
-#define HASH_BUCKET_SIZE 5000
+#define HASH_INITIAL_CAPACITY 1024
+// Grow once the table is 7/8 full, Robin Hood probing stays short up to there.
+#define HASH_MAX_LOAD_NUMERATOR 7
+#define HASH_MAX_LOAD_DENOMINATOR 8
+/*
+Old slots drained per mutation while a resize is in progress. The new table has
+room for (7/8 * 2 - 7/8) * old_capacity inserts before it needs to grow again,
+so any step above 2 finishes the drain well before that.
+*/
+#define HASH_MIGRATE_STEP 64
 
-#define MAX_LINE_SIZE 40
+/*
+Batched lookups work through the input in blocks, small enough for the hashed
+indices and resolved chunks to stay on the stack while their prefetches land.
+*/
+#define BATCH_BLOCK_SIZE 64
+#define PREFETCH(addr) __builtin_prefetch(addr)
+
+#define CHUNKS_INITIAL_CAPACITY 64
+/*
+Bulk inserts only reserve up front when the input arrives in runs of at least
+this many tiles per chunk. Scattered input would make the run count a wild
+overestimate of the chunks needed, so that case grows incrementally instead.
+*/
+#define BULK_MIN_RUN_LENGTH 4
+#define PALETTE_INITIAL_CAPACITY 16
+#define RESHAPE_RECTS_INITIAL_CAPACITY 16
+#define PACK_RGB(r, g, b) (((uint32_t)(r) << 16) | ((uint32_t)(g) << 8) | (b))
+
+#define SLOT_PROBE_LEN_MASK 0x7F
+#define SLOT_TOMBSTONE 0x80
+/*
+Probes never reach SLOT_PROBE_LEN_MASK, the table is rebuilt bigger instead.
+Once it is this many times sparser than the slots it holds and a probe still
+runs that long, the keys were picked to collide and doubling again is futile.
+*/
+#define HASH_MAX_SPARSITY 1024
+
+// Longest part of a malformed line shown in the logs.
+#define MAX_LOGGED_LINE_SIZE 48
+#define PARSE_BATCH_SIZE 65536
+// Smallest share of a text worth a thread of its own.
+#define PARSE_MIN_RANGE_SIZE (1024 * 1024)
+#define PARSE_INITIAL_SEGMENTS 4
 #define PERLINE_ATTR_COUNT 5
 #define LINES_PER_RECT 6
+/*
+Longest text of one rect, its blank line, 4 vertex lines of 6 values and 2
+index lines of 3, with every value at its widest.
+*/
+#define OBJ_RECT_MAX_TEXT_SIZE (1 + 4 * (2 + 6 * 12) + 2 * (1 + 3 * 12))
+
+// Text of one or a few space led values, copied whole as a fixed size block.
+typedef struct Struct_ObjTextPiece {
+  char text[32];
+  uint32_t length;
+} Struct_ObjTextPiece;
 
-static uint32_t KnuthMultiplicativeHash(int32_t x, int32_t y);
-static Enum_StatusCodes ParseVDataLine(char *data_line,
-                                       Struct_TileHashNode **tile_hash_arr,
-                                       uint32_t tile_size);
+// Fewest chunks worth a thread of their own when working out variants.
+#define VARIANT_MIN_CHUNKS_PER_THREAD 1024
 
-static uint32_t KnuthMultiplicativeHash(int32_t x, int32_t y) {
+// Slice of the dense chunks whose variants one thread works out.
+typedef struct Struct_VariantJob {
+  Struct_TileHashMap *pTile_hash_map;
+  Struct_TileBounds rect;
+  uint32_t first, last;
+} Struct_VariantJob;
+/*
+Binary chunk records up to this many tiles store a (cell, palette index) pair
+per tile, 4 bytes each. Fuller ones store the 128 bytes of occupancy rows and
+then 2 bytes per tile, which is the smaller of the two from here on.
+*/
+#define BINARY_SPARSE_CHUNK_LIMIT 64
+
+typedef struct Struct_BinaryChunkHeader {
+  int32_t chunk_x, chunk_y;
+  uint32_t count;
+} Struct_BinaryChunkHeader;
+
+static Struct_TileHashSlot *ProbeSlot(Struct_TileHashSlot *slots,
+                                      uint32_t capacity, uint32_t index,
+                                      int32_t chunk_x, int32_t chunk_y);
+static Struct_TileHashSlot *FindSlot(Struct_TileHashSlot *slots,
+                                     uint32_t capacity, int32_t chunk_x,
+                                     int32_t chunk_y);
+static uint8_t InsertSlot(Struct_TileHashSlot *slots, uint32_t capacity,
+                          Struct_TileHashSlot slot);
+static void EraseSlot(Struct_TileHashSlot *slots, uint32_t capacity,
+                      Struct_TileHashSlot *pSlot);
+static void MigrateTileHashMap(Struct_TileHashMap *pTile_hash_map,
+                               uint32_t step);
+static Enum_StatusCodes GrowTileHashMap(Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes RebuildTileHashMap(uint64_t capacity,
+                                           Struct_TileHashMap *pTile_hash_map);
+static Struct_TileChunk *FindChunk(const Struct_TileHashMap *pTile_hash_map,
+                                   int32_t chunk_x, int32_t chunk_y);
+static Enum_StatusCodes GrowDenseChunks(uint64_t needed,
+                                        Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes AllocChunk(Struct_TileHashMap *pTile_hash_map,
+                                   Struct_TileChunk **pDest);
+static void ReleaseChunk(Struct_TileHashMap *pTile_hash_map,
+                         Struct_TileChunk *chunk);
+static Enum_StatusCodes UnshareChunk(Struct_TileHashMap *pTile_hash_map,
+                                     Struct_TileChunk **pChunk);
+static void *CopyBlock(const void *src, size_t size);
+static Enum_StatusCodes UnshareTileHashMap(Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes CreateChunk(int32_t chunk_x, int32_t chunk_y,
+                                    Struct_TileHashMap *pTile_hash_map,
+                                    Struct_TileChunk **pDest);
+static Enum_StatusCodes InsertChunk(Struct_TileChunk *chunk,
+                                    Struct_TileHashMap *pTile_hash_map);
+static void DestroyChunk(Struct_TileChunk *chunk,
+                         Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes ClipChunkToRect(int32_t chunk_x, int32_t chunk_y,
+                                        int32_t min_x, int32_t min_y,
+                                        int32_t max_x, int32_t max_y,
+                                        uint32_t *pFirst_row,
+                                        uint32_t *pLast_row,
+                                        uint32_t *pCol_mask);
+static void EraseChunkRect(Struct_TileChunk *chunk, int32_t min_x,
+                           int32_t min_y, int32_t max_x, int32_t max_y,
+                           Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes CheckBlock(int32_t min_x, int32_t min_y,
+                                   uint32_t width, uint32_t height);
+static Enum_StatusCodes WriteChunkBlock(int32_t chunk_x, int32_t chunk_y,
+                                        int32_t min_x, int32_t min_y,
+                                        uint32_t width, uint32_t height,
+                                        const uint32_t *values,
+                                        Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes RemapChunkCells(Struct_TileChunk *chunk,
+                                        uint32_t first_row, uint32_t last_row,
+                                        uint32_t col_mask, uint16_t from,
+                                        uint16_t to,
+                                        Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes SetupRangeChunk(Struct_TileRangeIter *pIter,
+                                        const Struct_TileChunk *chunk);
+static Enum_StatusCodes AdvanceRangeChunk(Struct_TileRangeIter *pIter);
+static void ExpandBounds(int32_t x, int32_t y,
+                         Struct_TileHashMap *pTile_hash_map);
+static void ShrinkBounds(int32_t x, int32_t y,
+                         Struct_TileHashMap *pTile_hash_map);
+static void UnionBounds(Struct_TileBounds *pBounds, int32_t min_x,
+                        int32_t min_y, int32_t max_x, int32_t max_y);
+static void MarkReshaped(int32_t min_x, int32_t min_y, int32_t max_x,
+                         int32_t max_y, Struct_TileHashMap *pTile_hash_map);
+static void PublishReshaped(Struct_TileHashMap *pTile_hash_map);
+static void GetReshapeRect(const Struct_TileBounds *pReshaped,
+                           Struct_TileBounds *pRect);
+static uint64_t GetReshapeArea(const Struct_TileBounds *pReshaped);
+static uint64_t GetExtendedRow(const Struct_TileChunk *around[3][3],
+                               int32_t row);
+static void UpdateChunkVariants(Struct_TileChunk *chunk, uint32_t first_row,
+                                uint32_t last_row, uint32_t col_mask,
+                                Struct_TileHashMap *pTile_hash_map);
+static void UpdateVariants(int32_t min_x, int32_t min_y, int32_t max_x,
+                           int32_t max_y, Struct_TileHashMap *pTile_hash_map);
+static void *UpdateVariantsJob(void *pData);
+static void UpdateVariantsInParallel(Struct_TileHashMap *pTile_hash_map);
+static void InsertPaletteLookup(Struct_TilePalette *pPalette, uint32_t index);
+static Enum_StatusCodes GrowPalette(Struct_TilePalette *pPalette);
+static Enum_StatusCodes FindPaletteColor(uint32_t key,
+                                         const Struct_TilePalette *pPalette,
+                                         uint16_t *pIndex);
+static Enum_StatusCodes InternPaletteColor(uint8_t r, uint8_t g, uint8_t b,
+                                           Struct_TilePalette *pPalette,
+                                           uint16_t *pIndex);
+static const char *FindLineEnd(const char *cursor, const char *end);
+static const char *SkipLines(const char *cursor, const char *end,
+                             uint32_t count);
+static Enum_StatusCodes ParseDecimal(const char **pCursor, const char *end,
+                                     int32_t *pValue);
+static Enum_StatusCodes ParseVDataLine(const char **pCursor, const char *end,
+                                       uint32_t tile_size,
+                                       Struct_TileHashNode *pDest);
+static Enum_StatusCodes ScanTextTiles(const char **pCursor, const char *end,
+                                      uint32_t tile_size,
+                                      Struct_TileHashNode **pBatch,
+                                      uint32_t *pBatch_count,
+                                      const char **pLine,
+                                      size_t *pLine_length);
+static const char *FindRangeStart(const char *cursor, const char *end);
+static void RunInParallel(void *(*work)(void *), void *jobs, size_t job_size,
+                          uint32_t job_count);
+static void *ParseTextRange(void *pData);
+static void AddChunkRows(Struct_TileChunk *chunk,
+                         const uint32_t rows[TILE_CHUNK_SIZE],
+                         Struct_TileHashMap *pTile_hash_map);
+static Enum_StatusCodes AdoptTileHashMap(Struct_TileHashMap *pSource,
+                                         Struct_TileHashMap *pTile_hash_map);
+static void FormatObjTextPiece(Struct_ObjTextPiece *pPiece, int64_t value,
+                               uint8_t append);
+static char *AppendObjTextPiece(char *dest, const Struct_ObjTextPiece *pPiece);
+static Enum_StatusCodes DumpChunkBinary(const Struct_TileChunk *chunk,
+                                        FILE *file);
+static Enum_StatusCodes LoadChunkBinary(const uint8_t **pCursor,
+                                        const uint8_t *end,
+                                        const uint16_t *remap,
+                                        uint32_t palette_count,
+                                        Struct_TileHashMap *pTile_hash_map);
+
+uint32_t KnuthMultiplicativeHash(int32_t x, int32_t y) {
   uint32_t ux = (uint32_t)x * KNUTHS_X_MULTIPLIER;
   uint32_t uy = (uint32_t)y * KNUTHS_Y_MULTIPLIER;
   uint32_t raw_hash =
-      (ux ^ (uy >> 16) ^ (uy << 13) ^ (x >> 5) ^ (y << 7)); // Extra mixing
+      (ux ^ (uy >> 16) ^ (uy << 13) ^ (x >> 5) ^ ((uint32_t)y << 7)); // Mixing
+
+  return MixHashBits(raw_hash);
+}
+
+uint32_t MixHashBits(uint32_t hash) {
+  hash ^= hash >> 16;
+  hash *= KNUTHS_X_MULTIPLIER;
+  hash ^= hash >> 13;
+
+  return hash;
+}
+
+static Struct_TileHashSlot *ProbeSlot(Struct_TileHashSlot *slots,
+                                      uint32_t capacity, uint32_t index,
+                                      int32_t chunk_x, int32_t chunk_y) {
+  uint32_t mask = capacity - 1;
+
+  for (uint32_t probe_len = 1; probe_len < SLOT_PROBE_LEN_MASK; probe_len++) {
+    Struct_TileHashSlot *curr = &slots[index];
+    /*
+    Robin Hood invariant, had our key been here it would have displaced any
+    slot that is closer to its own home than we are to ours.
+    */
+    if ((curr->probe_len & SLOT_PROBE_LEN_MASK) < probe_len) {
+      return NULL;
+    }
+    if (curr->chunk_x == chunk_x && curr->chunk_y == chunk_y) {
+      return (curr->probe_len & SLOT_TOMBSTONE) ? NULL : curr;
+    }
+    index = (index + 1) & mask;
+  }
+
+  return NULL;
+}
+
+static Struct_TileHashSlot *FindSlot(Struct_TileHashSlot *slots,
+                                     uint32_t capacity, int32_t chunk_x,
+                                     int32_t chunk_y) {
+  return ProbeSlot(slots, capacity,
+                   KnuthMultiplicativeHash(chunk_x, chunk_y) & (capacity - 1),
+                   chunk_x, chunk_y);
+}
+
+// Returns 0 and leaves the table untouched if a probe would get too long.
+static uint8_t InsertSlot(Struct_TileHashSlot *slots, uint32_t capacity,
+                          Struct_TileHashSlot slot) {
+  uint32_t mask = capacity - 1;
+  uint32_t home = KnuthMultiplicativeHash(slot.chunk_x, slot.chunk_y) & mask;
+  uint32_t index = home;
+
+  // Dry run first, every slot pushed along carries on from its own length.
+  for (uint32_t probe_len = 1; slots[index].probe_len;
+       index = (index + 1) & mask) {
+    if (slots[index].probe_len < probe_len) {
+      probe_len = slots[index].probe_len;
+    }
+    if (++probe_len >= SLOT_PROBE_LEN_MASK) {
+      return 0;
+    }
+  }
+
+  index = home;
+  slot.probe_len = 1;
+  while (slots[index].probe_len) {
+    if (slots[index].probe_len < slot.probe_len) {
+      Struct_TileHashSlot temp = slots[index];
+      slots[index] = slot;
+      slot = temp;
+    }
+    index = (index + 1) & mask;
+    slot.probe_len++;
+  }
+  slots[index] = slot;
+
+  return 1;
+}
+
+static void EraseSlot(Struct_TileHashSlot *slots, uint32_t capacity,
+                      Struct_TileHashSlot *pSlot) {
+  uint32_t mask = capacity - 1;
+  uint32_t index = pSlot - slots;
+  uint32_t next = (index + 1) & mask;
 
-  return raw_hash % HASH_BUCKET_SIZE;
+  // Backward shift deletion, keeps probe lengths short without tombstones.
+  while (slots[next].probe_len > 1) {
+    slots[index] = slots[next];
+    slots[index].probe_len--;
+    index = next;
+    next = (next + 1) & mask;
+  }
+  slots[index].probe_len = 0;
+}
+
+static void MigrateTileHashMap(Struct_TileHashMap *pTile_hash_map,
+                               uint32_t step) {
+  if (!pTile_hash_map->old_slots) {
+    return;
+  }
+
+  Struct_TileHashSlot *old_slots = pTile_hash_map->old_slots;
+  while (step-- && pTile_hash_map->migrate_index <
+                       pTile_hash_map->old_capacity) {
+    Struct_TileHashSlot *curr = &old_slots[pTile_hash_map->migrate_index++];
+    if (curr->probe_len && !(curr->probe_len & SLOT_TOMBSTONE)) {
+      if (!InsertSlot(pTile_hash_map->slots, pTile_hash_map->capacity,
+                      *curr)) {
+        /*
+        The rebuild lists every slot and ends the drain. Should it fail the
+        slot stays where it is, lookups still find it in the old table.
+        */
+        pTile_hash_map->migrate_index--;
+        RebuildTileHashMap((uint64_t)pTile_hash_map->capacity * 2,
+                           pTile_hash_map);
+        return;
+      }
+      /*
+      Tombstoning instead of erasing, a backward shift could pull a slot from
+      ahead of migrate_index to behind it and it would never get migrated.
+      */
+      curr->probe_len |= SLOT_TOMBSTONE;
+      pTile_hash_map->old_chunk_count--;
+    }
+  }
+
+  if (pTile_hash_map->migrate_index >= pTile_hash_map->old_capacity) {
+    free(pTile_hash_map->old_slots);
+    pTile_hash_map->old_slots = NULL;
+    pTile_hash_map->old_capacity = 0;
+    pTile_hash_map->old_chunk_count = 0;
+    pTile_hash_map->migrate_index = 0;
+  }
 }
 
-Enum_StatusCodes InitTileHashMap(Struct_TileHashNode ***pTile_hash_arr) {
+static Enum_StatusCodes GrowTileHashMap(Struct_TileHashMap *pTile_hash_map) {
   Enum_StatusCodes status = SUCCESS;
 
-  *pTile_hash_arr = calloc(HASH_BUCKET_SIZE, sizeof(Struct_TileHashNode *));
-  if (!(*pTile_hash_arr)) {
-    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
-    Logger(&status, NULL, "Error produced by InitTileHashMap()",
+  // Only one drain at a time, finishing the previous one is cheap by now.
+  MigrateTileHashMap(pTile_hash_map, UINT32_MAX);
+
+  Struct_TileHashSlot *slots =
+      pTile_hash_map->old_slots
+          ? NULL
+          : calloc(pTile_hash_map->capacity * 2, sizeof(Struct_TileHashSlot));
+  if (!slots) {
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by GrowTileHashMap()",
            OUTPUT_LOG_STREAM);
     return status;
   }
 
+  pTile_hash_map->old_slots = pTile_hash_map->slots;
+  pTile_hash_map->old_capacity = pTile_hash_map->capacity;
+  pTile_hash_map->old_chunk_count = pTile_hash_map->chunk_count;
+  pTile_hash_map->migrate_index = 0;
+  pTile_hash_map->slots = slots;
+  pTile_hash_map->capacity *= 2;
+
   return status;
 }
 
-void FreeTileHashMap(Struct_TileHashNode ***pTile_hash_arr) {
-  Struct_TileHashNode *temp;
+/*
+Lists every chunk again in a fresh table of at least the given capacity, in one
+go straight from the dense array. Doubles further while some probe gets too
+long. The old tables are only replaced once the new one is complete.
+*/
+static Enum_StatusCodes RebuildTileHashMap(uint64_t capacity,
+                                           Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TileHashSlot *slots = NULL;
+  uint64_t max_capacity =
+      (uint64_t)pTile_hash_map->chunk_count * HASH_MAX_SPARSITY;
+  uint8_t fits = 0;
 
-  for (int32_t i = 0; i < HASH_BUCKET_SIZE; i++) {
-    while ((*pTile_hash_arr)[i]) {
-      temp = (*pTile_hash_arr)[i]->next;
-      free((*pTile_hash_arr)[i]);
-      (*pTile_hash_arr)[i] = temp;
+  while (!fits) {
+    // Whatever was asked for is tried once, however sparse.
+    if (capacity > UINT32_MAX || (slots && capacity > max_capacity)) {
+      status = UNEXPECTED_COMPUTED_RESULTS | LOW_SEVERITY_ERROR;
+      break;
+    }
+    free(slots);
+    if (!(slots = calloc(capacity, sizeof(Struct_TileHashSlot)))) {
+      status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+      break;
+    }
+    fits = 1;
+    for (uint32_t i = 0; i < pTile_hash_map->chunk_count && fits; i++) {
+      Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+      fits = InsertSlot(slots, capacity,
+                        (Struct_TileHashSlot){.chunk_x = chunk->chunk_x,
+                                              .chunk_y = chunk->chunk_y,
+                                              .chunk = chunk});
     }
+    capacity *= fits ? 1 : 2;
   }
-  free(*pTile_hash_arr);
-  (*pTile_hash_arr) = NULL;
+  if (status != SUCCESS) {
+    free(slots);
+    Logger(&status, NULL, "Error produced by RebuildTileHashMap()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  free(pTile_hash_map->slots);
+  free(pTile_hash_map->old_slots);
+  pTile_hash_map->slots = slots;
+  pTile_hash_map->capacity = capacity;
+  pTile_hash_map->old_slots = NULL;
+  pTile_hash_map->old_capacity = 0;
+  pTile_hash_map->old_chunk_count = 0;
+  pTile_hash_map->migrate_index = 0;
+
+  return status;
 }
 
-Enum_StatusCodes AddTileHashMapEntry(int32_t x, int32_t y, uint8_t r, uint8_t g,
-                                     uint8_t b,
-                                     Struct_TileHashNode **tile_hash_arr) {
+static Struct_TileChunk *FindChunk(const Struct_TileHashMap *pTile_hash_map,
+                                   int32_t chunk_x, int32_t chunk_y) {
+  Struct_TileHashSlot *slot = FindSlot(
+      pTile_hash_map->slots, pTile_hash_map->capacity, chunk_x, chunk_y);
+
+  if (!slot && pTile_hash_map->old_slots) {
+    slot = FindSlot(pTile_hash_map->old_slots, pTile_hash_map->old_capacity,
+                    chunk_x, chunk_y);
+  }
+
+  return slot ? slot->chunk : NULL;
+}
+
+static Enum_StatusCodes GrowDenseChunks(uint64_t needed,
+                                        Struct_TileHashMap *pTile_hash_map) {
   Enum_StatusCodes status = SUCCESS;
-  Struct_TileHashNode *node = malloc(sizeof(Struct_TileHashNode));
 
-  if (!node) {
+  if (needed <= pTile_hash_map->chunks_capacity) {
+    return status;
+  }
+
+  uint64_t chunks_capacity = pTile_hash_map->chunks_capacity
+                                 ? pTile_hash_map->chunks_capacity
+                                 : CHUNKS_INITIAL_CAPACITY;
+  while (chunks_capacity < needed) {
+    chunks_capacity *= 2;
+  }
+  Struct_TileChunk **chunks =
+      (chunks_capacity > UINT32_MAX)
+          ? NULL
+          : realloc(pTile_hash_map->chunks,
+                    chunks_capacity * sizeof(Struct_TileChunk *));
+  if (!chunks) {
     status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
-    Logger(&status, NULL, "Error produced by AddTileHashMapEntry()",
+    Logger(&status, NULL, "Error produced by GrowDenseChunks()",
            OUTPUT_LOG_STREAM);
     return status;
   }
-  node->x = x;
-  node->y = y;
-  node->r = r;
-  node->g = g;
-  node->b = b;
+  pTile_hash_map->chunks = chunks;
+  pTile_hash_map->chunks_capacity = chunks_capacity;
+
+  return status;
+}
 
-  uint32_t index = KnuthMultiplicativeHash(x, y);
+static Enum_StatusCodes AllocChunk(Struct_TileHashMap *pTile_hash_map,
+                                   Struct_TileChunk **pDest) {
+  Enum_StatusCodes status = SUCCESS;
 
-  node->next = tile_hash_arr[index];
-  tile_hash_arr[index] = node;
+  if (pTile_hash_map->free_chunks) {
+    *pDest = pTile_hash_map->free_chunks;
+    pTile_hash_map->free_chunks = (*pDest)->next_free;
+  } else {
+    if (!pTile_hash_map->slabs ||
+        pTile_hash_map->slab_used == TILE_CHUNKS_PER_SLAB) {
+      // Not calloc'd, every chunk gets cleared when it is handed out anyway.
+      Struct_TileChunkSlab *slab = malloc(sizeof(Struct_TileChunkSlab));
+      if (!slab) {
+        status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+        Logger(&status, NULL, "Error produced by AllocChunk()",
+               OUTPUT_LOG_STREAM);
+        return status;
+      }
+      slab->next = pTile_hash_map->slabs;
+      pTile_hash_map->slabs = slab;
+      pTile_hash_map->slab_used = 0;
+    }
+    *pDest = &pTile_hash_map->slabs->chunks[pTile_hash_map->slab_used++];
+  }
+  memset(*pDest, 0, sizeof(Struct_TileChunk));
+  (*pDest)->refs = 1;
 
   return status;
 }
 
-Enum_StatusCodes AccessTileHashMap(int32_t x, int32_t y,
-                                   Struct_TileHashNode **tile_hash_arr,
-                                   Struct_TileHashNode **pDest) {
-  uint32_t index = KnuthMultiplicativeHash(x, y);
+// Drops one directory's reference, the chunk is only recycled once unlisted.
+static void ReleaseChunk(Struct_TileHashMap *pTile_hash_map,
+                         Struct_TileChunk *chunk) {
+  if (--chunk->refs) {
+    return;
+  }
+  chunk->next_free = pTile_hash_map->free_chunks;
+  pTile_hash_map->free_chunks = chunk;
+}
 
-  *pDest = tile_hash_arr[index];
-  while (*pDest) {
-    if ((*pDest)->x == x && (*pDest)->y == y) {
-      return SUCCESS;
-    }
-    *pDest = (*pDest)->next;
+// Gives the map a private copy of a chunk a snapshot still lists.
+static Enum_StatusCodes UnshareChunk(Struct_TileHashMap *pTile_hash_map,
+                                     Struct_TileChunk **pChunk) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TileChunk *copy = NULL;
+
+  if ((*pChunk)->refs == 1) {
+    return status;
   }
-  *pDest = NULL;
 
-  return FAILURE;
+  Struct_TileHashSlot *slot =
+      FindSlot(pTile_hash_map->slots, pTile_hash_map->capacity,
+               (*pChunk)->chunk_x, (*pChunk)->chunk_y);
+  if (!slot && pTile_hash_map->old_slots) {
+    slot = FindSlot(pTile_hash_map->old_slots, pTile_hash_map->old_capacity,
+                    (*pChunk)->chunk_x, (*pChunk)->chunk_y);
+  }
+  // Only chunks listed by the map get here, anything else is a bug upstream.
+  if (!slot) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by UnshareChunk()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  if ((status = AllocChunk(pTile_hash_map, &copy)) != SUCCESS) {
+    return status;
+  }
+  *copy = **pChunk;
+  copy->refs = 1;
+
+  slot->chunk = copy;
+  pTile_hash_map->chunks[copy->dense_index] = copy;
+  (*pChunk)->refs--;
+  *pChunk = copy;
+
+  return status;
 }
 
-Enum_StatusCodes PopTileHashMapEntry(int32_t x, int32_t y,
-                                     Struct_TileHashNode **tile_hash_arr) {
-  uint32_t index = KnuthMultiplicativeHash(x, y);
-  Struct_TileHashNode *curr = tile_hash_arr[index];
-  Struct_TileHashNode *prev = NULL;
-
-  while (curr) {
-    if (curr->x == x && curr->y == y) {
-      if (!prev) {
-        tile_hash_arr[index] = curr->next;
-      } else {
-        prev->next = curr->next;
-      }
-      free(curr);
-      return SUCCESS;
-    }
-    prev = curr;
-    curr = curr->next;
+static void *CopyBlock(const void *src, size_t size) {
+  void *dest = src ? malloc(size) : NULL;
+
+  if (dest) {
+    memcpy(dest, src, size);
   }
 
-  return FAILURE;
+  return dest;
 }
 
-Enum_StatusCodes DumpDataToFile(Struct_TileHashNode **tile_hash_arr,
-                                const char *file_path, uint32_t tile_size) {
+/*
+Stops reading the tables of the snapshot taken last. Only pointers are copied,
+every chunk picks up a reference instead and gets copied once actually edited.
+*/
+static Enum_StatusCodes UnshareTileHashMap(Struct_TileHashMap *pTile_hash_map) {
   Enum_StatusCodes status = SUCCESS;
+  Struct_TilePalette *palette = &pTile_hash_map->palette;
+
+  if (!pTile_hash_map->pShared_snapshot) {
+    return status;
+  }
 
-  FILE *file = fopen(file_path, "w");
-  if (!file) {
-    status = INVALID_FILE_PATH | HIGH_SEVERITY_ERROR;
-    Logger(&status, NULL, "Error produced by DumpDataToFile()",
+  Struct_TileHashSlot *slots =
+      CopyBlock(pTile_hash_map->slots,
+                pTile_hash_map->capacity * sizeof(Struct_TileHashSlot));
+  Struct_TileHashSlot *old_slots =
+      CopyBlock(pTile_hash_map->old_slots,
+                pTile_hash_map->old_capacity * sizeof(Struct_TileHashSlot));
+  Struct_TileChunk **chunks =
+      CopyBlock(pTile_hash_map->chunks,
+                pTile_hash_map->chunks_capacity * sizeof(Struct_TileChunk *));
+  uint8_t(*colors)[3] = CopyBlock(palette->colors, palette->capacity * 3);
+  uint32_t *lookup =
+      CopyBlock(palette->lookup, palette->lookup_capacity * sizeof(uint32_t));
+  if (!slots || (pTile_hash_map->old_slots && !old_slots) ||
+      (pTile_hash_map->chunks && !chunks) || (palette->colors && !colors) ||
+      (palette->lookup && !lookup)) {
+    free(slots);
+    free(old_slots);
+    free(chunks);
+    free(colors);
+    free(lookup);
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by UnshareTileHashMap()",
            OUTPUT_LOG_STREAM);
     return status;
   }
 
-  int32_t vert_c = 0;
-  for (int32_t i = 0; i < HASH_BUCKET_SIZE; i++) {
-    Struct_TileHashNode *curr = tile_hash_arr[i];
-    while (curr) {
-      int32_t global_x_pos = curr->x * tile_size,
-              global_y_pos = curr->y * tile_size;
-      fprintf(file,
-              "\nv %d %d %d %d %d\n"
-              "v %d %d %d %d %d\n"
-              "v %d %d %d %d %d\n"
-              "v %d %d %d %d %d\n"
-              "i %d %d %d\n"
-              "i %d %d %d\n",
-              global_x_pos, global_y_pos, curr->r, curr->g, curr->b,
-              global_x_pos + tile_size, global_y_pos, curr->r, curr->g, curr->b,
-              global_x_pos, global_y_pos + tile_size, curr->r, curr->g, curr->b,
-              global_x_pos + tile_size, global_y_pos + tile_size, curr->r,
-              curr->g, curr->b, vert_c + 0, vert_c + 1, vert_c + 3, vert_c + 0,
-              vert_c + 2, vert_c + 3);
-      curr = curr->next;
-      vert_c += 4;
-    }
-  }
-  fclose(file);
-
-  return status;
-}
-
-Enum_StatusCodes ParseVDataLine(char *data_line,
-                                Struct_TileHashNode **tile_hash_arr,
-                                uint32_t tile_size) {
-  Enum_StatusCodes status = SUCCESS;
-  char *token = strtok(&data_line[2], " \n");
-  uint32_t i = 0;
-  int32_t x, y;
-  uint8_t r, g, b;
-
-  while (token && i < PERLINE_ATTR_COUNT) {
-    char *end_ptr;
-    int32_t data_token = strtol(token, &end_ptr, 10);
-    if (end_ptr[0] != '\0' || end_ptr == token) {
-      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
-      Logger(&status, NULL, data_line, OUTPUT_LOG_STREAM);
-      return status;
-    }
-    switch (i) {
-    case 0:
-      x = data_token;
-      break;
-    case 1:
-      y = data_token;
-      break;
-    case 2:
-      r = data_token;
-      break;
-    case 3:
-      g = data_token;
-      break;
-    case 4:
-      b = data_token;
-      break;
-    default:
-      break;
-    }
-    token = strtok(NULL, " \n");
-    i++;
+  pTile_hash_map->slots = slots;
+  pTile_hash_map->old_slots = old_slots;
+  pTile_hash_map->chunks = chunks;
+  palette->colors = colors;
+  palette->lookup = lookup;
+  for (uint32_t i = 0; i < pTile_hash_map->chunk_count; i++) {
+    pTile_hash_map->chunks[i]->refs++;
   }
-  if (i < PERLINE_ATTR_COUNT) {
-    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
-    Logger(&status, NULL, data_line, OUTPUT_LOG_STREAM);
+  pTile_hash_map->pShared_snapshot = NULL;
+
+  return status;
+}
+
+static Enum_StatusCodes CreateChunk(int32_t chunk_x, int32_t chunk_y,
+                                    Struct_TileHashMap *pTile_hash_map,
+                                    Struct_TileChunk **pDest) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if ((status = AllocChunk(pTile_hash_map, pDest)) != SUCCESS) {
     return status;
   }
+  (*pDest)->chunk_x = chunk_x;
+  (*pDest)->chunk_y = chunk_y;
+  if ((status = InsertChunk(*pDest, pTile_hash_map)) != SUCCESS) {
+    ReleaseChunk(pTile_hash_map, *pDest);
+  }
 
-  return AddTileHashMapEntry(x / tile_size, y / tile_size, r, g, b,
-                             tile_hash_arr);
+  return status;
 }
 
-Enum_StatusCodes ParseFileToData(Struct_TileHashNode **tile_hash_arr,
-                                 const char *file_path, uint32_t tile_size) {
+// Lists a chunk the map does not hold yet under its coordinates.
+static Enum_StatusCodes InsertChunk(Struct_TileChunk *chunk,
+                                    Struct_TileHashMap *pTile_hash_map) {
   Enum_StatusCodes status = SUCCESS;
-  FILE *file = fopen(file_path, "r");
 
-  if (!file) {
-    status = INVALID_FILE_PATH | HIGH_SEVERITY_ERROR;
-    Logger(&status, NULL, "Error produced by ParseFileToData()",
-           OUTPUT_LOG_STREAM);
+  if ((uint64_t)(pTile_hash_map->chunk_count + 1) * HASH_MAX_LOAD_DENOMINATOR >
+      (uint64_t)pTile_hash_map->capacity * HASH_MAX_LOAD_NUMERATOR) {
+    if ((status = GrowTileHashMap(pTile_hash_map)) != SUCCESS) {
+      return status;
+    }
+  }
+
+  if ((status = GrowDenseChunks((uint64_t)pTile_hash_map->chunk_count + 1,
+                                pTile_hash_map)) != SUCCESS) {
     return status;
   }
 
-  char buffer[MAX_LINE_SIZE];
+  chunk->dense_index = pTile_hash_map->chunk_count;
+  pTile_hash_map->chunks[pTile_hash_map->chunk_count++] = chunk;
+  if (!InsertSlot(pTile_hash_map->slots, pTile_hash_map->capacity,
+                  (Struct_TileHashSlot){.chunk_x = chunk->chunk_x,
+                                        .chunk_y = chunk->chunk_y,
+                                        .chunk = chunk}) &&
+      (status = RebuildTileHashMap((uint64_t)pTile_hash_map->capacity * 2,
+                                   pTile_hash_map)) != SUCCESS) {
+    pTile_hash_map->chunk_count--;
+  }
+
+  return status;
+}
 
-  while (fgets(buffer, sizeof(buffer), file)) {
-    if (buffer[strlen(buffer) - 1] != '\n' && !feof(file)) {
-      // Digesting the entire line to ignore.
-      char temp;
-      while ((temp = fgetc(file)) != '\n' && temp != EOF)
-        ;
-      continue;
-    } else if (buffer[0] == 'v' && buffer[1] == ' ') {
-      if ((status = ParseVDataLine(buffer, tile_hash_arr, tile_size)) !=
-          SUCCESS) {
-        fclose(file);
-        return status;
+static void DestroyChunk(Struct_TileChunk *chunk,
+                         Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileHashSlot *slot =
+      FindSlot(pTile_hash_map->slots, pTile_hash_map->capacity, chunk->chunk_x,
+               chunk->chunk_y);
+
+  if (slot) {
+    EraseSlot(pTile_hash_map->slots, pTile_hash_map->capacity, slot);
+  } else if (pTile_hash_map->old_slots &&
+             (slot = FindSlot(pTile_hash_map->old_slots,
+                              pTile_hash_map->old_capacity, chunk->chunk_x,
+                              chunk->chunk_y))) {
+    slot->probe_len |= SLOT_TOMBSTONE;
+    pTile_hash_map->old_chunk_count--;
+  }
+
+  // Swap remove, the last dense chunk takes over the hole.
+  Struct_TileChunk *last =
+      pTile_hash_map->chunks[--pTile_hash_map->chunk_count];
+  last->dense_index = chunk->dense_index;
+  pTile_hash_map->chunks[last->dense_index] = last;
+  ReleaseChunk(pTile_hash_map, chunk);
+}
+
+// Must run before tile_count is bumped for the new tile.
+static void ExpandBounds(int32_t x, int32_t y,
+                         Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileBounds *bounds = &pTile_hash_map->bounds;
+
+  if (!pTile_hash_map->tile_count) {
+    *bounds = (Struct_TileBounds){
+        .min_x = x, .min_y = y, .max_x = x, .max_y = y};
+    pTile_hash_map->bounds_stale = 0;
+    return;
+  }
+  bounds->min_x = (x < bounds->min_x) ? x : bounds->min_x;
+  bounds->min_y = (y < bounds->min_y) ? y : bounds->min_y;
+  bounds->max_x = (x > bounds->max_x) ? x : bounds->max_x;
+  bounds->max_y = (y > bounds->max_y) ? y : bounds->max_y;
+}
+
+// Must run after tile_count is dropped for the removed tile.
+static void ShrinkBounds(int32_t x, int32_t y,
+                         Struct_TileHashMap *pTile_hash_map) {
+  const Struct_TileBounds *bounds = &pTile_hash_map->bounds;
+
+  if (pTile_hash_map->tile_count &&
+      (x == bounds->min_x || x == bounds->max_x || y == bounds->min_y ||
+       y == bounds->max_y)) {
+    pTile_hash_map->bounds_stale = 1;
+  }
+}
+
+static void UnionBounds(Struct_TileBounds *pBounds, int32_t min_x,
+                        int32_t min_y, int32_t max_x, int32_t max_y) {
+  pBounds->min_x = (min_x < pBounds->min_x) ? min_x : pBounds->min_x;
+  pBounds->min_y = (min_y < pBounds->min_y) ? min_y : pBounds->min_y;
+  pBounds->max_x = (max_x > pBounds->max_x) ? max_x : pBounds->max_x;
+  pBounds->max_y = (max_y > pBounds->max_y) ? max_y : pBounds->max_y;
+}
+
+/*
+Cells that may have been filled or emptied, not just recoloured. Far apart
+edits are kept as rects of their own, so a commit only revisits the cells
+around each of them rather than everything in between. A rect is merged into
+the previous one when that costs no more cells than keeping both.
+*/
+static void MarkReshaped(int32_t min_x, int32_t min_y, int32_t max_x,
+                         int32_t max_y, Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileBounds rect = {
+      .min_x = min_x, .min_y = min_y, .max_x = max_x, .max_y = max_y};
+  // An empty list while something is pending means a grow failed earlier.
+  uint8_t listed = !pTile_hash_map->has_pending_reshape ||
+                   pTile_hash_map->reshape_rect_count;
+
+  if (!pTile_hash_map->has_pending_reshape) {
+    pTile_hash_map->pending_reshape = rect;
+    pTile_hash_map->has_pending_reshape = 1;
+  } else {
+    UnionBounds(&pTile_hash_map->pending_reshape, min_x, min_y, max_x, max_y);
+  }
+
+  if (listed && pTile_hash_map->reshape_rect_count) {
+    Struct_TileBounds *last =
+        &pTile_hash_map->reshape_rects[pTile_hash_map->reshape_rect_count - 1];
+    Struct_TileBounds merged = *last;
+    UnionBounds(&merged, min_x, min_y, max_x, max_y);
+    if (GetReshapeArea(&merged) <=
+        GetReshapeArea(last) + GetReshapeArea(&rect)) {
+      *last = merged;
+      listed = 0;
+    }
+  }
+  if (listed && pTile_hash_map->reshape_rect_count ==
+                    pTile_hash_map->reshape_rect_capacity) {
+    uint32_t capacity = pTile_hash_map->reshape_rect_capacity
+                            ? pTile_hash_map->reshape_rect_capacity * 2
+                            : RESHAPE_RECTS_INITIAL_CAPACITY;
+    Struct_TileBounds *rects = realloc(pTile_hash_map->reshape_rects,
+                                       capacity * sizeof(Struct_TileBounds));
+    if (rects) {
+      pTile_hash_map->reshape_rects = rects;
+      pTile_hash_map->reshape_rect_capacity = capacity;
+    } else {
+      // The bounds still cover everything, the commit falls back on them.
+      pTile_hash_map->reshape_rect_count = 0;
+      listed = 0;
+    }
+  }
+  if (listed) {
+    pTile_hash_map->reshape_rects[pTile_hash_map->reshape_rect_count++] = rect;
+  }
+
+  if (!pTile_hash_map->transaction_depth) {
+    PublishReshaped(pTile_hash_map);
+  }
+}
+
+static void PublishReshaped(Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileBounds rect;
+
+  if (!pTile_hash_map->has_pending_reshape) {
+    return;
+  }
+  if (!pTile_hash_map->reshape_rect_count) {
+    GetReshapeRect(&pTile_hash_map->pending_reshape, &rect);
+    UpdateVariants(rect.min_x, rect.min_y, rect.max_x, rect.max_y,
+                   pTile_hash_map);
+  }
+  for (uint32_t i = 0; i < pTile_hash_map->reshape_rect_count; i++) {
+    GetReshapeRect(&pTile_hash_map->reshape_rects[i], &rect);
+    UpdateVariants(rect.min_x, rect.min_y, rect.max_x, rect.max_y,
+                   pTile_hash_map);
+  }
+  pTile_hash_map->has_pending_reshape = 0;
+  pTile_hash_map->reshape_rect_count = 0;
+}
+
+// Variants depend on the neighbours, so the ring around changes as well.
+static void GetReshapeRect(const Struct_TileBounds *pReshaped,
+                           Struct_TileBounds *pRect) {
+  *pRect = (Struct_TileBounds){
+      .min_x = (pReshaped->min_x > INT32_MIN) ? pReshaped->min_x - 1
+                                              : pReshaped->min_x,
+      .min_y = (pReshaped->min_y > INT32_MIN) ? pReshaped->min_y - 1
+                                              : pReshaped->min_y,
+      .max_x = (pReshaped->max_x < INT32_MAX) ? pReshaped->max_x + 1
+                                              : pReshaped->max_x,
+      .max_y = (pReshaped->max_y < INT32_MAX) ? pReshaped->max_y + 1
+                                              : pReshaped->max_y};
+}
+
+// Cells a commit revisits for the rect, saturating instead of overflowing.
+static uint64_t GetReshapeArea(const Struct_TileBounds *pReshaped) {
+  uint64_t width = (int64_t)pReshaped->max_x - pReshaped->min_x + 3,
+           height = (int64_t)pReshaped->max_y - pReshaped->min_y + 3;
+
+  return (width > UINT32_MAX || height > UINT32_MAX) ? UINT64_MAX / 2
+                                                     : width * height;
+}
+
+/*
+Occupancy of a chunk row widened by the last column of the chunk to its left
+(bit 0) and the first column of the one to its right (bit 33). around holds
+the chunk and its 8 neighbours, row -1 and TILE_CHUNK_SIZE reach into the
+chunks above and below. Missing chunks read as empty.
+*/
+static uint64_t GetExtendedRow(const Struct_TileChunk *around[3][3],
+                               int32_t row) {
+  uint32_t around_y = (row < 0) ? 0 : (row > TILE_CHUNK_MASK) ? 2 : 1;
+  uint32_t local_y = row & TILE_CHUNK_MASK;
+  const Struct_TileChunk *left = around[around_y][0],
+                         *middle = around[around_y][1],
+                         *right = around[around_y][2];
+
+  return (left ? left->occupied[local_y] >> TILE_CHUNK_MASK : 0) |
+         (middle ? (uint64_t)middle->occupied[local_y] << 1 : 0) |
+         (right ? (uint64_t)(right->occupied[local_y] & 1)
+                      << (TILE_CHUNK_SIZE + 1)
+                : 0);
+}
+
+static void UpdateChunkVariants(Struct_TileChunk *chunk, uint32_t first_row,
+                                uint32_t last_row, uint32_t col_mask,
+                                Struct_TileHashMap *pTile_hash_map) {
+  const Struct_TileChunk *around[3][3] = {{NULL}};
+  uint32_t first_col = __builtin_ctz(col_mask),
+           last_col = TILE_CHUNK_MASK - __builtin_clz(col_mask);
+  uint8_t unshared = 0;
+
+  // Neighbouring chunks are only looked up when the range reaches their edge.
+  for (int32_t dy = -1; dy <= 1; dy++) {
+    for (int32_t dx = -1; dx <= 1; dx++) {
+      if ((dy < 0 && first_row) || (dy > 0 && last_row < TILE_CHUNK_MASK) ||
+          (dx < 0 && first_col) || (dx > 0 && last_col < TILE_CHUNK_MASK)) {
+        continue;
       }
-      // Digesting vertices and indices that makeup the rect and just directly
-      // building it here. Assuming data correctness.
-      for (int32_t i = 0; i < LINES_PER_RECT; i++) {
-        if (!fgets(buffer, MAX_LINE_SIZE, file) && !feof(file)) {
-          status = FILE_IO_ERROR | HIGH_SEVERITY_ERROR;
-          Logger(&status, NULL, "Error produced by ParseFileToData()",
-                 OUTPUT_LOG_STREAM);
-          fclose(file);
-          return status;
+      around[dy + 1][dx + 1] =
+          (dx || dy) ? FindChunk(pTile_hash_map, chunk->chunk_x + dx,
+                                 chunk->chunk_y + dy)
+                     : chunk;
+    }
+  }
+
+  for (uint32_t row = first_row; row <= last_row; row++) {
+    uint64_t up = GetExtendedRow(around, (int32_t)row - 1),
+             middle = GetExtendedRow(around, row),
+             down = GetExtendedRow(around, row + 1);
+    uint32_t row_bits = chunk->occupied[row] & col_mask;
+
+    while (row_bits) {
+      uint32_t col = __builtin_ctz(row_bits);
+      row_bits &= row_bits - 1;
+
+      // Column col sits at bit col + 1 of the extended rows.
+      uint8_t n = (up >> (col + 1)) & 1, e = (middle >> (col + 2)) & 1,
+              s = (down >> (col + 1)) & 1, w = (middle >> col) & 1;
+      uint8_t variant = (n ? TILE_NEIGHBOUR_N : 0) |
+                        (e ? TILE_NEIGHBOUR_E : 0) |
+                        (s ? TILE_NEIGHBOUR_S : 0) |
+                        (w ? TILE_NEIGHBOUR_W : 0);
+      if (n && e && ((up >> (col + 2)) & 1)) {
+        variant |= TILE_NEIGHBOUR_NE;
+      }
+      if (s && e && ((down >> (col + 2)) & 1)) {
+        variant |= TILE_NEIGHBOUR_SE;
+      }
+      if (s && w && ((down >> col) & 1)) {
+        variant |= TILE_NEIGHBOUR_SW;
+      }
+      if (n && w && ((up >> col) & 1)) {
+        variant |= TILE_NEIGHBOUR_NW;
+      }
+
+      uint32_t index = row * TILE_CHUNK_SIZE + col;
+      if (chunk->variants[index] == variant) {
+        continue;
+      }
+      // A copy keeps the same occupancy, so around stays valid for reading.
+      if (!unshared && UnshareChunk(pTile_hash_map, &chunk) != SUCCESS) {
+        return;
+      }
+      unshared = 1;
+      chunk->variants[index] = variant;
+    }
+  }
+}
+
+static void UpdateVariants(int32_t min_x, int32_t min_y, int32_t max_x,
+                           int32_t max_y, Struct_TileHashMap *pTile_hash_map) {
+  uint64_t rect_chunks =
+      (uint64_t)((int64_t)(max_x >> TILE_CHUNK_SHIFT) -
+                 (min_x >> TILE_CHUNK_SHIFT) + 1) *
+      (uint64_t)((int64_t)(max_y >> TILE_CHUNK_SHIFT) -
+                 (min_y >> TILE_CHUNK_SHIFT) + 1);
+  uint32_t first_row, last_row, col_mask;
+
+  // Same choice as the range iterator, look up chunks or walk the live ones.
+  if (rect_chunks <= pTile_hash_map->chunk_count) {
+    for (int32_t chunk_y = min_y >> TILE_CHUNK_SHIFT;
+         chunk_y <= max_y >> TILE_CHUNK_SHIFT; chunk_y++) {
+      for (int32_t chunk_x = min_x >> TILE_CHUNK_SHIFT;
+           chunk_x <= max_x >> TILE_CHUNK_SHIFT; chunk_x++) {
+        Struct_TileChunk *chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+        if (chunk &&
+            ClipChunkToRect(chunk_x, chunk_y, min_x, min_y, max_x, max_y,
+                            &first_row, &last_row, &col_mask) == SUCCESS) {
+          UpdateChunkVariants(chunk, first_row, last_row, col_mask,
+                              pTile_hash_map);
         }
       }
     }
+    return;
+  }
+  for (uint32_t i = 0; i < pTile_hash_map->chunk_count; i++) {
+    Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+    if (ClipChunkToRect(chunk->chunk_x, chunk->chunk_y, min_x, min_y, max_x,
+                        max_y, &first_row, &last_row, &col_mask) == SUCCESS) {
+      UpdateChunkVariants(chunk, first_row, last_row, col_mask,
+                          pTile_hash_map);
+    }
   }
-  fclose(file);
+}
 
-  return SUCCESS;
+static void *UpdateVariantsJob(void *pData) {
+  const Struct_VariantJob *pJob = pData;
+  Struct_TileHashMap *pTile_hash_map = pJob->pTile_hash_map;
+  const Struct_TileBounds *rect = &pJob->rect;
+  uint32_t first_row, last_row, col_mask;
+
+  for (uint32_t i = pJob->first; i < pJob->last; i++) {
+    Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+    if (chunk->refs == 1 &&
+        ClipChunkToRect(chunk->chunk_x, chunk->chunk_y, rect->min_x,
+                        rect->min_y, rect->max_x, rect->max_y, &first_row,
+                        &last_row, &col_mask) == SUCCESS) {
+      UpdateChunkVariants(chunk, first_row, last_row, col_mask,
+                          pTile_hash_map);
+    }
+  }
+
+  return NULL;
+}
+
+/*
+Works out the variants of a large pending reshape ahead of the commit, the
+dense chunks split between threads. Each chunk only writes its own variants
+and reads the occupancy around it, which nothing changes meanwhile. Chunks a
+snapshot still lists are left to the end, unsharing them changes the map.
+*/
+static void UpdateVariantsInParallel(Struct_TileHashMap *pTile_hash_map) {
+  Struct_VariantJob jobs[PARSE_MAX_THREADS];
+  uint32_t job_count = GetProcessorCount(),
+           chunk_count = pTile_hash_map->chunk_count;
+  uint32_t first_row, last_row, col_mask;
+  Struct_TileBounds rect;
+
+  if (job_count > PARSE_MAX_THREADS) {
+    job_count = PARSE_MAX_THREADS;
+  }
+  if (job_count > chunk_count / VARIANT_MIN_CHUNKS_PER_THREAD) {
+    job_count = chunk_count / VARIANT_MIN_CHUNKS_PER_THREAD;
+  }
+  // Small ones are left to the commit.
+  if (!pTile_hash_map->has_pending_reshape || job_count < 2) {
+    return;
+  }
+
+  // One pass over the chunks, so the bounds of everything pending are used.
+  GetReshapeRect(&pTile_hash_map->pending_reshape, &rect);
+  for (uint32_t i = 0; i < job_count; i++) {
+    jobs[i] = (Struct_VariantJob){
+        .pTile_hash_map = pTile_hash_map,
+        .rect = rect,
+        .first = (uint32_t)((uint64_t)chunk_count * i / job_count),
+        .last = (uint32_t)((uint64_t)chunk_count * (i + 1) / job_count)};
+  }
+  RunInParallel(UpdateVariantsJob, jobs, sizeof(Struct_VariantJob),
+                job_count);
+
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+    if (chunk->refs > 1 &&
+        ClipChunkToRect(chunk->chunk_x, chunk->chunk_y, rect.min_x,
+                        rect.min_y, rect.max_x, rect.max_y, &first_row,
+                        &last_row, &col_mask) == SUCCESS) {
+      UpdateChunkVariants(chunk, first_row, last_row, col_mask,
+                          pTile_hash_map);
+    }
+  }
+  pTile_hash_map->has_pending_reshape = 0;
+  pTile_hash_map->reshape_rect_count = 0;
+}
+
+static void InsertPaletteLookup(Struct_TilePalette *pPalette, uint32_t index) {
+  uint32_t mask = pPalette->lookup_capacity - 1;
+  const uint8_t *color = pPalette->colors[index];
+  uint32_t i =
+      KnuthMultiplicativeHash(PACK_RGB(color[0], color[1], color[2]), 0) &
+      mask;
+
+  while (pPalette->lookup[i]) {
+    i = (i + 1) & mask;
+  }
+  pPalette->lookup[i] = index + 1;
+}
+
+static Enum_StatusCodes GrowPalette(Struct_TilePalette *pPalette) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t capacity =
+      pPalette->capacity ? pPalette->capacity * 2 : PALETTE_INITIAL_CAPACITY;
+
+  uint8_t(*colors)[3] = realloc(pPalette->colors, capacity * 3);
+  // Lookup is kept at most half full so linear probing stays short.
+  uint32_t *lookup = calloc(capacity * 2, sizeof(uint32_t));
+  if (!colors || !lookup) {
+    if (colors) {
+      pPalette->colors = colors;
+    }
+    free(lookup);
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by GrowPalette()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  free(pPalette->lookup);
+  pPalette->colors = colors;
+  pPalette->capacity = capacity;
+  pPalette->lookup = lookup;
+  pPalette->lookup_capacity = capacity * 2;
+  for (uint32_t i = 0; i < pPalette->count; i++) {
+    InsertPaletteLookup(pPalette, i);
+  }
+
+  return status;
+}
+
+static Enum_StatusCodes FindPaletteColor(uint32_t key,
+                                         const Struct_TilePalette *pPalette,
+                                         uint16_t *pIndex) {
+  if (!pPalette->lookup_capacity) {
+    return FAILURE;
+  }
+
+  uint32_t mask = pPalette->lookup_capacity - 1;
+  for (uint32_t i = KnuthMultiplicativeHash(key, 0) & mask; pPalette->lookup[i];
+       i = (i + 1) & mask) {
+    const uint8_t *color = pPalette->colors[pPalette->lookup[i] - 1];
+    if (PACK_RGB(color[0], color[1], color[2]) == key) {
+      *pIndex = pPalette->lookup[i] - 1;
+      return SUCCESS;
+    }
+  }
+
+  return FAILURE;
+}
+
+static Enum_StatusCodes InternPaletteColor(uint8_t r, uint8_t g, uint8_t b,
+                                           Struct_TilePalette *pPalette,
+                                           uint16_t *pIndex) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if (FindPaletteColor(PACK_RGB(r, g, b), pPalette, pIndex) == SUCCESS) {
+    return status;
+  }
+
+  if (pPalette->count == TILE_PALETTE_MAX_COLORS) {
+    status = UNEXPECTED_COMPUTED_RESULTS | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by InternPaletteColor()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  if (pPalette->count == pPalette->capacity &&
+      (status = GrowPalette(pPalette)) != SUCCESS) {
+    return status;
+  }
+
+  *pIndex = pPalette->count++;
+  pPalette->colors[*pIndex][0] = r;
+  pPalette->colors[*pIndex][1] = g;
+  pPalette->colors[*pIndex][2] = b;
+  InsertPaletteLookup(pPalette, *pIndex);
+
+  return status;
+}
+
+Enum_StatusCodes InitTileHashMap(Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+
+  *pTile_hash_map = (Struct_TileHashMap){0};
+  pTile_hash_map->slots =
+      calloc(HASH_INITIAL_CAPACITY, sizeof(Struct_TileHashSlot));
+  if (!pTile_hash_map->slots) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by InitTileHashMap()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  pTile_hash_map->capacity = HASH_INITIAL_CAPACITY;
+
+  return status;
+}
+
+void FreeTileHashMap(Struct_TileHashMap *pTile_hash_map) {
+  Struct_TileChunkSlab *temp;
+
+  while (pTile_hash_map->slabs) {
+    temp = pTile_hash_map->slabs->next;
+    free(pTile_hash_map->slabs);
+    pTile_hash_map->slabs = temp;
+  }
+  free(pTile_hash_map->slots);
+  free(pTile_hash_map->old_slots);
+  free(pTile_hash_map->chunks);
+  free(pTile_hash_map->palette.colors);
+  free(pTile_hash_map->palette.lookup);
+  free(pTile_hash_map->reshape_rects);
+  *pTile_hash_map = (Struct_TileHashMap){0};
+}
+
+Enum_StatusCodes ReserveTileHashMap(uint32_t chunk_count,
+                                    Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint64_t needed = (uint64_t)pTile_hash_map->chunk_count + chunk_count;
+
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS ||
+      (status = GrowDenseChunks(needed, pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+
+  uint64_t capacity = pTile_hash_map->capacity;
+  while (needed * HASH_MAX_LOAD_DENOMINATOR >
+         capacity * HASH_MAX_LOAD_NUMERATOR) {
+    capacity *= 2;
+  }
+  if (capacity == pTile_hash_map->capacity) {
+    return status;
+  }
+
+  /*
+  Reserving is an explicit request to pay for the rehash now, so it is done in
+  one go straight from the dense array instead of draining the old tables.
+  */
+  return RebuildTileHashMap(capacity, pTile_hash_map);
+}
+
+Enum_StatusCodes AddTileHashMapEntry(int32_t x, int32_t y, uint8_t r, uint8_t g,
+                                     uint8_t b,
+                                     Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+  MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+
+  uint16_t palette_index = 0;
+  if ((status = InternPaletteColor(r, g, b, &pTile_hash_map->palette,
+                                   &palette_index)) != SUCCESS) {
+    return status;
+  }
+
+  // Arithmetic shift, so negative coordinates floor into their chunk.
+  int32_t chunk_x = x >> TILE_CHUNK_SHIFT, chunk_y = y >> TILE_CHUNK_SHIFT;
+  Struct_TileChunk *chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+  if (chunk ? (status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS
+            : (status = CreateChunk(chunk_x, chunk_y, pTile_hash_map,
+                                    &chunk)) != SUCCESS) {
+    return status;
+  }
+
+  uint32_t local_x = x & TILE_CHUNK_MASK, local_y = y & TILE_CHUNK_MASK;
+  uint8_t added = !HAS_FLAG(chunk->occupied[local_y], 1U << local_x);
+  if (added) {
+    SET_FLAG(chunk->occupied[local_y], 1U << local_x);
+    chunk->count++;
+    ExpandBounds(x, y, pTile_hash_map);
+    pTile_hash_map->tile_count++;
+  }
+  chunk->cells[local_y * TILE_CHUNK_SIZE + local_x] = palette_index;
+  if (added) {
+    MarkReshaped(x, y, x, y, pTile_hash_map);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes AddTileHashMapEntries(const Struct_TileHashNode *tiles,
+                                       uint32_t count, uint8_t is_unique,
+                                       Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t chunk_runs = 0;
+  Struct_TileBounds touched = {.min_x = INT32_MAX, .min_y = INT32_MAX,
+                               .max_x = INT32_MIN, .max_y = INT32_MIN};
+
+  if (!count) {
+    return status;
+  }
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    touched.min_x = (tiles[i].x < touched.min_x) ? tiles[i].x : touched.min_x;
+    touched.min_y = (tiles[i].y < touched.min_y) ? tiles[i].y : touched.min_y;
+    touched.max_x = (tiles[i].x > touched.max_x) ? tiles[i].x : touched.max_x;
+    touched.max_y = (tiles[i].y > touched.max_y) ? tiles[i].y : touched.max_y;
+    if (!i || (tiles[i].x >> TILE_CHUNK_SHIFT) !=
+                  (tiles[i - 1].x >> TILE_CHUNK_SHIFT) ||
+        (tiles[i].y >> TILE_CHUNK_SHIFT) !=
+            (tiles[i - 1].y >> TILE_CHUNK_SHIFT)) {
+      chunk_runs++;
+    }
+  }
+  if ((uint64_t)chunk_runs * BULK_MIN_RUN_LENGTH <= count &&
+      (status = ReserveTileHashMap(chunk_runs, pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+  // Marked up front, a failure part way still leaves a superset. The
+  // transaction holds the variants back until the tiles are in.
+  BeginTileTransaction(pTile_hash_map);
+  MarkReshaped(touched.min_x, touched.min_y, touched.max_x, touched.max_y,
+               pTile_hash_map);
+
+  // Consecutive tiles mostly share a chunk and a colour, so both are cached.
+  Struct_TileChunk *chunk = NULL;
+  uint32_t last_rgb = 0;
+  uint16_t palette_index = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const Struct_TileHashNode *tile = &tiles[i];
+    int32_t chunk_x = tile->x >> TILE_CHUNK_SHIFT,
+            chunk_y = tile->y >> TILE_CHUNK_SHIFT;
+    if (!chunk || chunk->chunk_x != chunk_x || chunk->chunk_y != chunk_y) {
+      MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+      chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+      if (chunk ? (status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS
+                : (status = CreateChunk(chunk_x, chunk_y, pTile_hash_map,
+                                        &chunk)) != SUCCESS) {
+        break;
+      }
+    }
+
+    uint32_t rgb = PACK_RGB(tile->r, tile->g, tile->b);
+    if (!i || rgb != last_rgb) {
+      if ((status = InternPaletteColor(tile->r, tile->g, tile->b,
+                                       &pTile_hash_map->palette,
+                                       &palette_index)) != SUCCESS) {
+        break;
+      }
+      last_rgb = rgb;
+    }
+
+    uint32_t local_x = tile->x & TILE_CHUNK_MASK,
+             local_y = tile->y & TILE_CHUNK_MASK;
+    if (is_unique || !HAS_FLAG(chunk->occupied[local_y], 1U << local_x)) {
+      SET_FLAG(chunk->occupied[local_y], 1U << local_x);
+      chunk->count++;
+      ExpandBounds(tile->x, tile->y, pTile_hash_map);
+      pTile_hash_map->tile_count++;
+    }
+    chunk->cells[local_y * TILE_CHUNK_SIZE + local_x] = palette_index;
+  }
+  CommitTileTransaction(pTile_hash_map);
+
+  return status;
+}
+
+void BeginTileTransaction(Struct_TileHashMap *pTile_hash_map) {
+  pTile_hash_map->transaction_depth++;
+}
+
+void CommitTileTransaction(Struct_TileHashMap *pTile_hash_map) {
+  if (pTile_hash_map->transaction_depth &&
+      !--pTile_hash_map->transaction_depth) {
+    PublishReshaped(pTile_hash_map);
+  }
+}
+
+Enum_StatusCodes FillTileHashMapRect(int32_t min_x, int32_t min_y,
+                                     int32_t max_x, int32_t max_y, uint8_t r,
+                                     uint8_t g, uint8_t b,
+                                     Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  int32_t min_chunk_x = min_x >> TILE_CHUNK_SHIFT,
+          min_chunk_y = min_y >> TILE_CHUNK_SHIFT,
+          max_chunk_x = max_x >> TILE_CHUNK_SHIFT,
+          max_chunk_y = max_y >> TILE_CHUNK_SHIFT;
+  uint64_t rect_chunks =
+      (uint64_t)((int64_t)max_chunk_x - min_chunk_x + 1) *
+      (uint64_t)((int64_t)max_chunk_y - min_chunk_y + 1);
+
+  if (min_x > max_x || min_y > max_y) {
+    return FAILURE;
+  }
+
+  uint16_t palette_index;
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS ||
+      (status = InternPaletteColor(r, g, b, &pTile_hash_map->palette,
+                                   &palette_index)) != SUCCESS) {
+    return status;
+  }
+  // Every chunk the rectangle touches ends up live, so room is made up front.
+  if (rect_chunks > UINT32_MAX) {
+    return FAILURE;
+  }
+  if ((status = ReserveTileHashMap(rect_chunks, pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+
+  // The whole rectangle ends up occupied, so the bounds just take it in.
+  if (!pTile_hash_map->tile_count) {
+    pTile_hash_map->bounds = (Struct_TileBounds){
+        .min_x = min_x, .min_y = min_y, .max_x = max_x, .max_y = max_y};
+    pTile_hash_map->bounds_stale = 0;
+  } else {
+    ExpandBounds(min_x, min_y, pTile_hash_map);
+    ExpandBounds(max_x, max_y, pTile_hash_map);
+  }
+  BeginTileTransaction(pTile_hash_map);
+  MarkReshaped(min_x, min_y, max_x, max_y, pTile_hash_map);
+
+  for (int32_t chunk_y = min_chunk_y;
+       chunk_y <= max_chunk_y && status == SUCCESS; chunk_y++) {
+    for (int32_t chunk_x = min_chunk_x;
+         chunk_x <= max_chunk_x && status == SUCCESS; chunk_x++) {
+      uint32_t first_row, last_row, col_mask;
+      if (ClipChunkToRect(chunk_x, chunk_y, min_x, min_y, max_x, max_y,
+                          &first_row, &last_row, &col_mask) != SUCCESS) {
+        continue;
+      }
+
+      MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+      Struct_TileChunk *chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+      if (chunk ? (status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS
+                : (status = CreateChunk(chunk_x, chunk_y, pTile_hash_map,
+                                        &chunk)) != SUCCESS) {
+        continue;
+      }
+
+      uint32_t first_col = __builtin_ctz(col_mask),
+               last_col = TILE_CHUNK_MASK - __builtin_clz(col_mask);
+      for (uint32_t row = first_row; row <= last_row; row++) {
+        uint32_t added = col_mask & ~chunk->occupied[row];
+        chunk->count += __builtin_popcount(added);
+        pTile_hash_map->tile_count += __builtin_popcount(added);
+        chunk->occupied[row] |= col_mask;
+        uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+        for (uint32_t col = first_col; col <= last_col; col++) {
+          cells[col] = palette_index;
+        }
+      }
+    }
+  }
+  CommitTileTransaction(pTile_hash_map);
+
+  return status;
+}
+
+static void EraseChunkRect(Struct_TileChunk *chunk, int32_t min_x,
+                           int32_t min_y, int32_t max_x, int32_t max_y,
+                           Struct_TileHashMap *pTile_hash_map) {
+  uint32_t first_row, last_row, col_mask, removed = 0;
+
+  if (ClipChunkToRect(chunk->chunk_x, chunk->chunk_y, min_x, min_y, max_x,
+                      max_y, &first_row, &last_row, &col_mask) != SUCCESS) {
+    return;
+  }
+  for (uint32_t row = first_row; row <= last_row; row++) {
+    removed |= chunk->occupied[row] & col_mask;
+  }
+  // Untouched chunks are left alone, and shared with a snapshot if they were.
+  if (!removed || UnshareChunk(pTile_hash_map, &chunk) != SUCCESS) {
+    return;
+  }
+
+  for (uint32_t row = first_row; row <= last_row; row++) {
+    removed = chunk->occupied[row] & col_mask;
+    chunk->count -= __builtin_popcount(removed);
+    pTile_hash_map->tile_count -= __builtin_popcount(removed);
+    chunk->occupied[row] &= ~col_mask;
+  }
+  pTile_hash_map->bounds_stale = 1;
+  if (!chunk->count) {
+    DestroyChunk(chunk, pTile_hash_map);
+  }
+}
+
+Enum_StatusCodes EraseTileHashMapRect(int32_t min_x, int32_t min_y,
+                                      int32_t max_x, int32_t max_y,
+                                      Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  int32_t min_chunk_x = min_x >> TILE_CHUNK_SHIFT,
+          min_chunk_y = min_y >> TILE_CHUNK_SHIFT,
+          max_chunk_x = max_x >> TILE_CHUNK_SHIFT,
+          max_chunk_y = max_y >> TILE_CHUNK_SHIFT;
+  uint64_t rect_chunks =
+      (uint64_t)((int64_t)max_chunk_x - min_chunk_x + 1) *
+      (uint64_t)((int64_t)max_chunk_y - min_chunk_y + 1);
+
+  if (min_x > max_x || min_y > max_y) {
+    return FAILURE;
+  }
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+  MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+  uint32_t tile_count = pTile_hash_map->tile_count;
+
+  // Same choice as the range iterator, look up chunks or walk the live ones.
+  if (rect_chunks <= pTile_hash_map->chunk_count) {
+    for (int32_t chunk_y = min_chunk_y; chunk_y <= max_chunk_y; chunk_y++) {
+      for (int32_t chunk_x = min_chunk_x; chunk_x <= max_chunk_x; chunk_x++) {
+        Struct_TileChunk *chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+        if (chunk) {
+          EraseChunkRect(chunk, min_x, min_y, max_x, max_y, pTile_hash_map);
+        }
+      }
+    }
+  } else {
+    // Backwards, destroying a chunk swaps in one that was already visited.
+    for (uint32_t i = pTile_hash_map->chunk_count; i-- > 0;) {
+      EraseChunkRect(pTile_hash_map->chunks[i], min_x, min_y, max_x, max_y,
+                     pTile_hash_map);
+    }
+  }
+  if (!pTile_hash_map->tile_count) {
+    pTile_hash_map->bounds_stale = 0;
+  }
+  if (pTile_hash_map->tile_count != tile_count) {
+    MarkReshaped(min_x, min_y, max_x, max_y, pTile_hash_map);
+  }
+
+  return status;
+}
+
+// A block must be non empty and stay inside the int32_t grid.
+static Enum_StatusCodes CheckBlock(int32_t min_x, int32_t min_y,
+                                   uint32_t width, uint32_t height) {
+  if (!width || !height || (int64_t)min_x + width - 1 > INT32_MAX ||
+      (int64_t)min_y + height - 1 > INT32_MAX) {
+    return FAILURE;
+  }
+
+  return SUCCESS;
+}
+
+Enum_StatusCodes ReadTileHashMapBlock(int32_t min_x, int32_t min_y,
+                                      uint32_t width, uint32_t height,
+                                      const Struct_TileHashMap *pTile_hash_map,
+                                      uint32_t *pDest) {
+  if (CheckBlock(min_x, min_y, width, height) != SUCCESS) {
+    return FAILURE;
+  }
+  int32_t max_x = min_x + (int32_t)(width - 1),
+          max_y = min_y + (int32_t)(height - 1);
+
+  memset(pDest, 0, (size_t)width * height * sizeof(uint32_t));
+  for (int32_t chunk_y = min_y >> TILE_CHUNK_SHIFT;
+       chunk_y <= max_y >> TILE_CHUNK_SHIFT; chunk_y++) {
+    for (int32_t chunk_x = min_x >> TILE_CHUNK_SHIFT;
+         chunk_x <= max_x >> TILE_CHUNK_SHIFT; chunk_x++) {
+      const Struct_TileChunk *chunk =
+          FindChunk(pTile_hash_map, chunk_x, chunk_y);
+      uint32_t first_row, last_row, col_mask;
+      if (!chunk || ClipChunkToRect(chunk_x, chunk_y, min_x, min_y, max_x,
+                                    max_y, &first_row, &last_row,
+                                    &col_mask) != SUCCESS) {
+        continue;
+      }
+
+      // Offsets of the chunk's first cell within the block, may be negative.
+      int64_t block_x = (int64_t)chunk_x * TILE_CHUNK_SIZE - min_x,
+              block_y = (int64_t)chunk_y * TILE_CHUNK_SIZE - min_y;
+      for (uint32_t row = first_row; row <= last_row; row++) {
+        uint32_t *dest = &pDest[(block_y + row) * width + block_x];
+        uint32_t row_bits = chunk->occupied[row] & col_mask;
+        while (row_bits) {
+          uint32_t col = __builtin_ctz(row_bits);
+          const uint8_t *color =
+              pTile_hash_map->palette
+                  .colors[chunk->cells[row * TILE_CHUNK_SIZE + col]];
+          dest[col] = TILE_VALUE(color[0], color[1], color[2]);
+          row_bits &= row_bits - 1;
+        }
+      }
+    }
+  }
+
+  return SUCCESS;
+}
+
+static Enum_StatusCodes WriteChunkBlock(int32_t chunk_x, int32_t chunk_y,
+                                        int32_t min_x, int32_t min_y,
+                                        uint32_t width, uint32_t height,
+                                        const uint32_t *values,
+                                        Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  int32_t max_x = min_x + (int32_t)(width - 1),
+          max_y = min_y + (int32_t)(height - 1);
+  uint32_t first_row, last_row, col_mask;
+
+  if (ClipChunkToRect(chunk_x, chunk_y, min_x, min_y, max_x, max_y,
+                      &first_row, &last_row, &col_mask) != SUCCESS) {
+    return status;
+  }
+  uint32_t first_col = __builtin_ctz(col_mask),
+           last_col = TILE_CHUNK_MASK - __builtin_clz(col_mask);
+  int64_t start_x = (int64_t)chunk_x * TILE_CHUNK_SIZE,
+          start_y = (int64_t)chunk_y * TILE_CHUNK_SIZE;
+  const uint32_t *src = &values[(start_y - min_y) * width + (start_x - min_x)];
+
+  Struct_TileChunk *chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+  if (!chunk) {
+    // Only empty values over a missing chunk, there is nothing to write.
+    uint8_t has_tiles = 0;
+    for (uint32_t row = first_row; row <= last_row && !has_tiles; row++) {
+      for (uint32_t col = first_col; col <= last_col; col++) {
+        has_tiles |= src[row * width + col] != TILE_VALUE_EMPTY;
+      }
+    }
+    if (!has_tiles) {
+      return status;
+    }
+  }
+  if (chunk ? (status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS
+            : (status = CreateChunk(chunk_x, chunk_y, pTile_hash_map,
+                                    &chunk)) != SUCCESS) {
+    return status;
+  }
+
+  // Blocks rarely hold many colours, so runs of the same one skip the intern.
+  uint32_t last_value = TILE_VALUE_EMPTY;
+  uint16_t palette_index = 0;
+  for (uint32_t row = first_row; row <= last_row; row++) {
+    uint32_t new_bits = 0;
+    for (uint32_t col = first_col; col <= last_col; col++) {
+      uint32_t value = src[row * width + col];
+      if (value == TILE_VALUE_EMPTY) {
+        continue;
+      }
+      if (value != last_value &&
+          (status = InternPaletteColor(value >> 16, value >> 8, value,
+                                       &pTile_hash_map->palette,
+                                       &palette_index)) != SUCCESS) {
+        return status;
+      }
+      last_value = value;
+      new_bits |= 1U << col;
+      chunk->cells[row * TILE_CHUNK_SIZE + col] = palette_index;
+    }
+
+    uint32_t old_bits = chunk->occupied[row] & col_mask;
+    uint32_t removed = old_bits & ~new_bits, added = new_bits & ~old_bits;
+    chunk->occupied[row] = (chunk->occupied[row] & ~col_mask) | new_bits;
+    chunk->count += __builtin_popcount(added);
+    chunk->count -= __builtin_popcount(removed);
+    pTile_hash_map->tile_count -= __builtin_popcount(removed);
+    if (removed) {
+      pTile_hash_map->bounds_stale = 1;
+    }
+    // The row's outermost tiles cover it, the count goes up in between as
+    // ExpandBounds restarts the bounds on an empty map.
+    if (new_bits) {
+      ExpandBounds(start_x + __builtin_ctz(new_bits), start_y + row,
+                   pTile_hash_map);
+      pTile_hash_map->tile_count += __builtin_popcount(added);
+      ExpandBounds(start_x + TILE_CHUNK_MASK - __builtin_clz(new_bits),
+                   start_y + row, pTile_hash_map);
+    }
+  }
+  if (!chunk->count) {
+    DestroyChunk(chunk, pTile_hash_map);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes WriteTileHashMapBlock(int32_t min_x, int32_t min_y,
+                                       uint32_t width, uint32_t height,
+                                       const uint32_t *values,
+                                       Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if (CheckBlock(min_x, min_y, width, height) != SUCCESS) {
+    return FAILURE;
+  }
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+  int32_t max_x = min_x + (int32_t)(width - 1),
+          max_y = min_y + (int32_t)(height - 1);
+  BeginTileTransaction(pTile_hash_map);
+  MarkReshaped(min_x, min_y, max_x, max_y, pTile_hash_map);
+
+  for (int32_t chunk_y = min_y >> TILE_CHUNK_SHIFT;
+       chunk_y <= max_y >> TILE_CHUNK_SHIFT && status == SUCCESS; chunk_y++) {
+    for (int32_t chunk_x = min_x >> TILE_CHUNK_SHIFT;
+         chunk_x <= max_x >> TILE_CHUNK_SHIFT && status == SUCCESS;
+         chunk_x++) {
+      MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+      status = WriteChunkBlock(chunk_x, chunk_y, min_x, min_y, width, height,
+                               values, pTile_hash_map);
+    }
+  }
+  if (!pTile_hash_map->tile_count) {
+    pTile_hash_map->bounds_stale = 0;
+  }
+  CommitTileTransaction(pTile_hash_map);
+
+  return status;
+}
+
+/*
+Plain compare and select loops over the index rows, which the compiler turns
+into SIMD. Free cells hold stale indices, remapping them along is harmless and
+keeps the loops branch free.
+*/
+static Enum_StatusCodes RemapChunkCells(Struct_TileChunk *chunk,
+                                        uint32_t first_row, uint32_t last_row,
+                                        uint32_t col_mask, uint16_t from,
+                                        uint16_t to,
+                                        Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t first_col = __builtin_ctz(col_mask),
+           last_col = TILE_CHUNK_MASK - __builtin_clz(col_mask);
+  uint16_t hits = 0;
+
+  // Looked for first, so chunks shared with a snapshot are only copied if hit.
+  for (uint32_t row = first_row; row <= last_row; row++) {
+    const uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+    for (uint32_t col = first_col; col <= last_col; col++) {
+      hits |= cells[col] == from;
+    }
+  }
+  if (!hits || (status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS) {
+    return status;
+  }
+
+  for (uint32_t row = first_row; row <= last_row; row++) {
+    uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+    for (uint32_t col = first_col; col <= last_col; col++) {
+      cells[col] = (cells[col] == from) ? to : cells[col];
+    }
+  }
+
+  return status;
+}
+
+Enum_StatusCodes ReplaceTileHashMapColor(uint8_t from_r, uint8_t from_g,
+                                         uint8_t from_b, uint8_t to_r,
+                                         uint8_t to_g, uint8_t to_b,
+                                         const Struct_TileBounds *pRegion,
+                                         Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TilePalette *palette = &pTile_hash_map->palette;
+  uint16_t from, to;
+
+  if (PACK_RGB(from_r, from_g, from_b) == PACK_RGB(to_r, to_g, to_b) ||
+      FindPaletteColor(PACK_RGB(from_r, from_g, from_b), palette, &from) !=
+          SUCCESS ||
+      !pTile_hash_map->tile_count ||
+      (pRegion &&
+       (pRegion->min_x > pRegion->max_x || pRegion->min_y > pRegion->max_y))) {
+    return FAILURE;
+  }
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+
+  // Every tile using the entry changes, so the entry itself is recoloured.
+  if (!pRegion && FindPaletteColor(PACK_RGB(to_r, to_g, to_b), palette, &to) !=
+                      SUCCESS) {
+    palette->colors[from][0] = to_r;
+    palette->colors[from][1] = to_g;
+    palette->colors[from][2] = to_b;
+    memset(palette->lookup, 0, palette->lookup_capacity * sizeof(uint32_t));
+    for (uint32_t i = 0; i < palette->count; i++) {
+      InsertPaletteLookup(palette, i);
+    }
+    return status;
+  }
+  if ((status = InternPaletteColor(to_r, to_g, to_b, palette, &to)) !=
+      SUCCESS) {
+    return status;
+  }
+
+  Struct_TileBounds region;
+  if (pRegion) {
+    region = *pRegion;
+  } else {
+    GetTileHashMapBounds(pTile_hash_map, &region);
+  }
+  uint64_t region_chunks =
+      (uint64_t)((int64_t)(region.max_x >> TILE_CHUNK_SHIFT) -
+                 (region.min_x >> TILE_CHUNK_SHIFT) + 1) *
+      (uint64_t)((int64_t)(region.max_y >> TILE_CHUNK_SHIFT) -
+                 (region.min_y >> TILE_CHUNK_SHIFT) + 1);
+  // Same choice as the range iterator, look up chunks or walk the live ones.
+  if (region_chunks <= pTile_hash_map->chunk_count) {
+    for (int32_t chunk_y = region.min_y >> TILE_CHUNK_SHIFT;
+         chunk_y <= region.max_y >> TILE_CHUNK_SHIFT && status == SUCCESS;
+         chunk_y++) {
+      for (int32_t chunk_x = region.min_x >> TILE_CHUNK_SHIFT;
+           chunk_x <= region.max_x >> TILE_CHUNK_SHIFT && status == SUCCESS;
+           chunk_x++) {
+        Struct_TileChunk *chunk = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+        uint32_t first_row, last_row, col_mask;
+        if (chunk &&
+            ClipChunkToRect(chunk_x, chunk_y, region.min_x, region.min_y,
+                            region.max_x, region.max_y, &first_row, &last_row,
+                            &col_mask) == SUCCESS) {
+          status = RemapChunkCells(chunk, first_row, last_row, col_mask, from,
+                                   to, pTile_hash_map);
+        }
+      }
+    }
+    return status;
+  }
+  for (uint32_t i = 0; i < pTile_hash_map->chunk_count && status == SUCCESS;
+       i++) {
+    Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+    uint32_t first_row, last_row, col_mask;
+    if (ClipChunkToRect(chunk->chunk_x, chunk->chunk_y, region.min_x,
+                        region.min_y, region.max_x, region.max_y, &first_row,
+                        &last_row, &col_mask) == SUCCESS) {
+      status = RemapChunkCells(chunk, first_row, last_row, col_mask, from, to,
+                               pTile_hash_map);
+    }
+  }
+
+  return status;
+}
+
+Enum_StatusCodes AccessTileHashMap(int32_t x, int32_t y,
+                                   const Struct_TileHashMap *pTile_hash_map,
+                                   Struct_TileHashNode *pDest) {
+  const Struct_TileChunk *chunk = FindChunk(
+      pTile_hash_map, x >> TILE_CHUNK_SHIFT, y >> TILE_CHUNK_SHIFT);
+  uint32_t local_x = x & TILE_CHUNK_MASK, local_y = y & TILE_CHUNK_MASK;
+
+  if (!chunk || !HAS_FLAG(chunk->occupied[local_y], 1U << local_x)) {
+    return FAILURE;
+  }
+  const uint8_t *color =
+      pTile_hash_map->palette
+          .colors[chunk->cells[local_y * TILE_CHUNK_SIZE + local_x]];
+  *pDest = (Struct_TileHashNode){
+      .x = x,
+      .y = y,
+      .r = color[0],
+      .g = color[1],
+      .b = color[2],
+      .variant = chunk->variants[local_y * TILE_CHUNK_SIZE + local_x]};
+
+  return SUCCESS;
+}
+
+Enum_StatusCodes PopTileHashMapEntry(int32_t x, int32_t y,
+                                     Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+  MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+
+  Struct_TileChunk *chunk = FindChunk(pTile_hash_map, x >> TILE_CHUNK_SHIFT,
+                                      y >> TILE_CHUNK_SHIFT);
+  uint32_t local_x = x & TILE_CHUNK_MASK, local_y = y & TILE_CHUNK_MASK;
+
+  if (!chunk || !HAS_FLAG(chunk->occupied[local_y], 1U << local_x)) {
+    return FAILURE;
+  }
+  if ((status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS) {
+    return status;
+  }
+  CLEAR_FLAG(chunk->occupied[local_y], 1U << local_x);
+  chunk->count--;
+  pTile_hash_map->tile_count--;
+  ShrinkBounds(x, y, pTile_hash_map);
+  if (!chunk->count) {
+    DestroyChunk(chunk, pTile_hash_map);
+  }
+  MarkReshaped(x, y, x, y, pTile_hash_map);
+
+  return status;
+}
+
+Enum_StatusCodes
+AccessTileHashMapBatch(const int32_t *xs, const int32_t *ys, uint32_t count,
+                       const Struct_TileHashMap *pTile_hash_map,
+                       Struct_TileHashNode *pDest_arr,
+                       Enum_StatusCodes *pStatus_arr) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t mask = pTile_hash_map->capacity - 1;
+  uint32_t homes[BATCH_BLOCK_SIZE];
+  const Struct_TileChunk *chunks[BATCH_BLOCK_SIZE];
+
+  for (uint32_t base = 0; base < count; base += BATCH_BLOCK_SIZE) {
+    const int32_t *block_xs = xs + base, *block_ys = ys + base;
+    uint32_t block_size = (count - base < BATCH_BLOCK_SIZE) ? count - base
+                                                            : BATCH_BLOCK_SIZE;
+
+    // Straight line arithmetic only, so this pass vectorizes.
+    for (uint32_t i = 0; i < block_size; i++) {
+      homes[i] = KnuthMultiplicativeHash(block_xs[i] >> TILE_CHUNK_SHIFT,
+                                         block_ys[i] >> TILE_CHUNK_SHIFT) &
+                 mask;
+    }
+    for (uint32_t i = 0; i < block_size; i++) {
+      PREFETCH(&pTile_hash_map->slots[homes[i]]);
+    }
+
+    /*
+    By now the first slots have arrived. Resolving every chunk before touching
+    any cell lets the cell prefetches overlap in the same way.
+    */
+    for (uint32_t i = 0; i < block_size; i++) {
+      int32_t chunk_x = block_xs[i] >> TILE_CHUNK_SHIFT,
+              chunk_y = block_ys[i] >> TILE_CHUNK_SHIFT;
+      if (i && chunk_x == (block_xs[i - 1] >> TILE_CHUNK_SHIFT) &&
+          chunk_y == (block_ys[i - 1] >> TILE_CHUNK_SHIFT)) {
+        // Batches usually come in runs of neighbours, skip the probe.
+        chunks[i] = chunks[i - 1];
+      } else {
+        Struct_TileHashSlot *slot =
+            ProbeSlot(pTile_hash_map->slots, pTile_hash_map->capacity,
+                      homes[i], chunk_x, chunk_y);
+        if (!slot && pTile_hash_map->old_slots) {
+          slot = FindSlot(pTile_hash_map->old_slots,
+                          pTile_hash_map->old_capacity, chunk_x, chunk_y);
+        }
+        chunks[i] = slot ? slot->chunk : NULL;
+      }
+      if (chunks[i]) {
+        PREFETCH(&chunks[i]->occupied[block_ys[i] & TILE_CHUNK_MASK]);
+        PREFETCH(&chunks[i]->cells[(block_ys[i] & TILE_CHUNK_MASK) *
+                                       TILE_CHUNK_SIZE +
+                                   (block_xs[i] & TILE_CHUNK_MASK)]);
+      }
+    }
+
+    for (uint32_t i = 0; i < block_size; i++) {
+      uint32_t local_x = block_xs[i] & TILE_CHUNK_MASK,
+               local_y = block_ys[i] & TILE_CHUNK_MASK;
+      if (!chunks[i] ||
+          !HAS_FLAG(chunks[i]->occupied[local_y], 1U << local_x)) {
+        pStatus_arr[base + i] = FAILURE;
+        status = FAILURE;
+        continue;
+      }
+      const uint8_t *color =
+          pTile_hash_map->palette
+              .colors[chunks[i]->cells[local_y * TILE_CHUNK_SIZE + local_x]];
+      pDest_arr[base + i] = (Struct_TileHashNode){
+          .x = block_xs[i],
+          .y = block_ys[i],
+          .r = color[0],
+          .g = color[1],
+          .b = color[2],
+          .variant =
+              chunks[i]->variants[local_y * TILE_CHUNK_SIZE + local_x]};
+      pStatus_arr[base + i] = SUCCESS;
+    }
+  }
+
+  return status;
+}
+
+Enum_StatusCodes AccessTileChunk(int32_t chunk_x, int32_t chunk_y,
+                                 const Struct_TileHashMap *pTile_hash_map,
+                                 const Struct_TileChunk **pDest) {
+  *pDest = FindChunk(pTile_hash_map, chunk_x, chunk_y);
+
+  return *pDest ? SUCCESS : FAILURE;
+}
+
+/*
+Rows of a chunk inside an inclusive rectangle and a mask of its columns inside
+it, FAILURE if the two do not overlap.
+*/
+static Enum_StatusCodes ClipChunkToRect(int32_t chunk_x, int32_t chunk_y,
+                                        int32_t min_x, int32_t min_y,
+                                        int32_t max_x, int32_t max_y,
+                                        uint32_t *pFirst_row,
+                                        uint32_t *pLast_row,
+                                        uint32_t *pCol_mask) {
+  // 64 bit math, the rectangle may span the whole int32_t range.
+  int64_t start_x = (int64_t)chunk_x * TILE_CHUNK_SIZE,
+          start_y = (int64_t)chunk_y * TILE_CHUNK_SIZE;
+  int64_t first_col = min_x - start_x, last_col = max_x - start_x;
+  int64_t first_row = min_y - start_y, last_row = max_y - start_y;
+
+  first_col = (first_col < 0) ? 0 : first_col;
+  first_row = (first_row < 0) ? 0 : first_row;
+  last_col = (last_col > TILE_CHUNK_MASK) ? TILE_CHUNK_MASK : last_col;
+  last_row = (last_row > TILE_CHUNK_MASK) ? TILE_CHUNK_MASK : last_row;
+  if (first_col > last_col || first_row > last_row) {
+    return FAILURE;
+  }
+
+  *pFirst_row = first_row;
+  *pLast_row = last_row;
+  *pCol_mask = (UINT32_MAX >> (TILE_CHUNK_MASK - last_col)) &
+               (UINT32_MAX << first_col);
+
+  return SUCCESS;
+}
+
+static Enum_StatusCodes SetupRangeChunk(Struct_TileRangeIter *pIter,
+                                        const Struct_TileChunk *chunk) {
+  if (ClipChunkToRect(chunk->chunk_x, chunk->chunk_y, pIter->min_x,
+                      pIter->min_y, pIter->max_x, pIter->max_y, &pIter->row,
+                      &pIter->last_row, &pIter->col_mask) != SUCCESS) {
+    return FAILURE;
+  }
+
+  pIter->chunk = chunk;
+  pIter->row_bits = chunk->occupied[pIter->row] & pIter->col_mask;
+
+  return SUCCESS;
+}
+
+static Enum_StatusCodes AdvanceRangeChunk(Struct_TileRangeIter *pIter) {
+  const Struct_TileChunk *chunk;
+
+  if (pIter->walk_dense) {
+    while (pIter->dense_index < pIter->pTile_hash_map->chunk_count) {
+      chunk = pIter->pTile_hash_map->chunks[pIter->dense_index++];
+      if (SetupRangeChunk(pIter, chunk) == SUCCESS) {
+        return SUCCESS;
+      }
+    }
+    return FAILURE;
+  }
+
+  int32_t min_chunk_x = pIter->min_x >> TILE_CHUNK_SHIFT,
+          max_chunk_x = pIter->max_x >> TILE_CHUNK_SHIFT,
+          max_chunk_y = pIter->max_y >> TILE_CHUNK_SHIFT;
+  while (pIter->chunk_y <= max_chunk_y) {
+    int32_t chunk_x = pIter->chunk_x, chunk_y = pIter->chunk_y;
+    if (pIter->chunk_x++ == max_chunk_x) {
+      pIter->chunk_x = min_chunk_x;
+      pIter->chunk_y++;
+    }
+    if ((chunk = FindChunk(pIter->pTile_hash_map, chunk_x, chunk_y)) &&
+        SetupRangeChunk(pIter, chunk) == SUCCESS) {
+      return SUCCESS;
+    }
+  }
+
+  return FAILURE;
+}
+
+void InitTileRangeIter(Struct_TileRangeIter *pIter,
+                       const Struct_TileHashMap *pTile_hash_map, int32_t min_x,
+                       int32_t min_y, int32_t max_x, int32_t max_y) {
+  const Struct_TileBounds *bounds = &pTile_hash_map->bounds;
+
+  if (!pTile_hash_map->tile_count) {
+    // Nothing to walk, make the rectangle empty.
+    min_x = 1;
+    max_x = 0;
+  } else {
+    // Bounds are a superset even when stale, so clipping never loses a tile.
+    min_x = (min_x < bounds->min_x) ? bounds->min_x : min_x;
+    min_y = (min_y < bounds->min_y) ? bounds->min_y : min_y;
+    max_x = (max_x > bounds->max_x) ? bounds->max_x : max_x;
+    max_y = (max_y > bounds->max_y) ? bounds->max_y : max_y;
+  }
+
+  *pIter = (Struct_TileRangeIter){.pTile_hash_map = pTile_hash_map,
+                                  .min_x = min_x,
+                                  .min_y = min_y,
+                                  .max_x = max_x,
+                                  .max_y = max_y,
+                                  .chunk_x = min_x >> TILE_CHUNK_SHIFT,
+                                  .chunk_y = min_y >> TILE_CHUNK_SHIFT};
+
+  if (min_x > max_x || min_y > max_y) {
+    // Empty rectangle, park the chunk scan past its end.
+    pIter->chunk_y = (max_y >> TILE_CHUNK_SHIFT) + 1;
+    return;
+  }
+
+  uint64_t rect_chunks =
+      (uint64_t)((int64_t)(max_x >> TILE_CHUNK_SHIFT) - pIter->chunk_x + 1) *
+      (uint64_t)((int64_t)(max_y >> TILE_CHUNK_SHIFT) - pIter->chunk_y + 1);
+  pIter->walk_dense = rect_chunks > pTile_hash_map->chunk_count;
+}
+
+Enum_StatusCodes NextTileInRange(Struct_TileRangeIter *pIter,
+                                 Struct_TileHashNode *pDest) {
+  while (1) {
+    if (pIter->row_bits) {
+      uint32_t local_x = __builtin_ctz(pIter->row_bits);
+      pIter->row_bits &= pIter->row_bits - 1;
+
+      const uint8_t *color =
+          pIter->pTile_hash_map->palette
+              .colors[pIter->chunk->cells[pIter->row * TILE_CHUNK_SIZE +
+                                          local_x]];
+      *pDest = (Struct_TileHashNode){
+          .x = pIter->chunk->chunk_x * TILE_CHUNK_SIZE + (int32_t)local_x,
+          .y = pIter->chunk->chunk_y * TILE_CHUNK_SIZE + (int32_t)pIter->row,
+          .r = color[0],
+          .g = color[1],
+          .b = color[2],
+          .variant = pIter->chunk->variants[pIter->row * TILE_CHUNK_SIZE +
+                                            local_x]};
+      return SUCCESS;
+    }
+
+    if (pIter->chunk && pIter->row < pIter->last_row) {
+      pIter->row++;
+      pIter->row_bits = pIter->chunk->occupied[pIter->row] & pIter->col_mask;
+    } else if (AdvanceRangeChunk(pIter) != SUCCESS) {
+      pIter->chunk = NULL;
+      return FAILURE;
+    }
+  }
+}
+
+Enum_StatusCodes CreateTileSnapshot(Struct_TileHashMap *pTile_hash_map,
+                                    Struct_TileHashMap *pSnapshot) {
+  Enum_StatusCodes status = SUCCESS;
+
+  // Only one snapshot can lend its tables to the map at a time.
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS) {
+    return status;
+  }
+
+  *pSnapshot = *pTile_hash_map;
+  // Chunks are always allocated from, and recycled into, the live map.
+  pSnapshot->slabs = NULL;
+  pSnapshot->slab_used = 0;
+  pSnapshot->free_chunks = NULL;
+  pSnapshot->reshape_rects = NULL;
+  pSnapshot->reshape_rect_count = pSnapshot->reshape_rect_capacity = 0;
+  pTile_hash_map->pShared_snapshot = pSnapshot;
+
+  return status;
+}
+
+void FreeTileSnapshot(Struct_TileHashMap *pSnapshot,
+                      Struct_TileHashMap *pTile_hash_map) {
+  if (pTile_hash_map->pShared_snapshot == pSnapshot) {
+    // The map never moved off the snapshot's tables, it simply keeps them.
+    pTile_hash_map->pShared_snapshot = NULL;
+    *pSnapshot = (Struct_TileHashMap){0};
+    return;
+  }
+
+  for (uint32_t i = 0; i < pSnapshot->chunk_count; i++) {
+    ReleaseChunk(pTile_hash_map, pSnapshot->chunks[i]);
+  }
+  free(pSnapshot->slots);
+  free(pSnapshot->old_slots);
+  free(pSnapshot->chunks);
+  free(pSnapshot->palette.colors);
+  free(pSnapshot->palette.lookup);
+  *pSnapshot = (Struct_TileHashMap){0};
+}
+
+Enum_StatusCodes GetTileHashMapBounds(Struct_TileHashMap *pTile_hash_map,
+                                      Struct_TileBounds *pDest) {
+  if (!pTile_hash_map->tile_count) {
+    return FAILURE;
+  }
+
+  if (pTile_hash_map->bounds_stale) {
+    Struct_TileBounds bounds = {INT32_MAX, INT32_MAX, INT32_MIN, INT32_MIN};
+    for (uint32_t i = 0; i < pTile_hash_map->chunk_count; i++) {
+      const Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+      int32_t start_x = chunk->chunk_x * TILE_CHUNK_SIZE,
+              start_y = chunk->chunk_y * TILE_CHUNK_SIZE;
+      int32_t first_row = -1, last_row = 0;
+      uint32_t cols = 0;
+      for (int32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+        if (chunk->occupied[row]) {
+          first_row = (first_row < 0) ? row : first_row;
+          last_row = row;
+          cols |= chunk->occupied[row];
+        }
+      }
+      // Live chunks always hold a tile, so first_row and cols are set here.
+      int32_t min_x = start_x + __builtin_ctz(cols),
+              max_x = start_x + TILE_CHUNK_MASK - __builtin_clz(cols);
+      bounds.min_x = (min_x < bounds.min_x) ? min_x : bounds.min_x;
+      bounds.max_x = (max_x > bounds.max_x) ? max_x : bounds.max_x;
+      bounds.min_y = (start_y + first_row < bounds.min_y) ? start_y + first_row
+                                                          : bounds.min_y;
+      bounds.max_y = (start_y + last_row > bounds.max_y) ? start_y + last_row
+                                                         : bounds.max_y;
+    }
+    pTile_hash_map->bounds = bounds;
+    pTile_hash_map->bounds_stale = 0;
+  }
+  *pDest = pTile_hash_map->bounds;
+
+  return SUCCESS;
+}
+
+uint32_t CountTilesInRange(const Struct_TileHashMap *pTile_hash_map,
+                           int32_t min_x, int32_t min_y, int32_t max_x,
+                           int32_t max_y) {
+  Struct_TileRangeIter iter;
+  uint32_t count = 0;
+
+  // Only the iterator's chunk walk is used, the tiles themselves are not.
+  InitTileRangeIter(&iter, pTile_hash_map, min_x, min_y, max_x, max_y);
+  while (AdvanceRangeChunk(&iter) == SUCCESS) {
+    if (iter.col_mask == UINT32_MAX && iter.row == 0 &&
+        iter.last_row == TILE_CHUNK_MASK) {
+      count += iter.chunk->count;
+      continue;
+    }
+    for (uint32_t row = iter.row; row <= iter.last_row; row++) {
+      count += __builtin_popcount(iter.chunk->occupied[row] & iter.col_mask);
+    }
+  }
+
+  return count;
+}
+
+// Sets the piece to the value with a space before it, or adds it to the end.
+static void FormatObjTextPiece(Struct_ObjTextPiece *pPiece, int64_t value,
+                               uint8_t append) {
+  char *text = &pPiece->text[append ? pPiece->length : 0];
+
+  *text++ = ' ';
+  pPiece->length = FormatDecimal(text, value) - pPiece->text;
+}
+
+/*
+Copies the whole block whatever the length, a fixed size copy is a couple of
+moves where a sized one is a call. Callers leave the slack for it.
+*/
+static char *AppendObjTextPiece(char *dest, const Struct_ObjTextPiece *pPiece) {
+  memcpy(dest, pPiece->text, sizeof(pPiece->text));
+
+  return dest + pPiece->length;
+}
+
+Enum_StatusCodes DumpDataToFile(const Struct_TileHashMap *pTile_hash_map,
+                                const char *file_path, uint32_t tile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TextWriter writer;
+  int32_t vert_c = 0;
+
+  if ((status = OpenTextWriter(file_path, &writer)) != SUCCESS) {
+    return status;
+  }
+  DumpDataToText(pTile_hash_map, &writer, tile_size, &vert_c);
+
+  return CloseTextWriter(&writer);
+}
+
+void DumpDataToText(const Struct_TileHashMap *pTile_hash_map,
+                    Struct_TextWriter *pWriter, uint32_t tile_size,
+                    int32_t *pVert_count) {
+  // Unsigned so the indices wrap like the coordinates instead of overflowing.
+  uint32_t vert_c = *pVert_count;
+
+  for (uint32_t i = 0; i < pTile_hash_map->chunk_count; i++) {
+    const Struct_TileChunk *chunk = pTile_hash_map->chunks[i];
+    for (uint32_t local_y = 0; local_y < TILE_CHUNK_SIZE; local_y++) {
+      uint32_t row_bits = chunk->occupied[local_y];
+      while (row_bits) {
+        uint32_t local_x = __builtin_ctz(row_bits);
+        row_bits &= row_bits - 1;
+
+        char *out = ReserveText(pWriter, OBJ_RECT_MAX_TEXT_SIZE +
+                                             sizeof(Struct_ObjTextPiece));
+        if (!out) {
+          return;
+        }
+        uint32_t index = local_y * TILE_CHUNK_SIZE + local_x;
+        const uint8_t *color =
+            pTile_hash_map->palette.colors[chunk->cells[index]];
+        uint32_t global_x_pos =
+                     ((uint32_t)chunk->chunk_x * TILE_CHUNK_SIZE + local_x) *
+                     tile_size,
+                 global_y_pos =
+                     ((uint32_t)chunk->chunk_y * TILE_CHUNK_SIZE + local_y) *
+                     tile_size;
+        Struct_ObjTextPiece xs[2], ys[2], indices[4], tail;
+
+        /*
+        Each value shows up in several lines of the rect, so every distinct one
+        is formatted once and the lines are put together from the pieces.
+        */
+        FormatObjTextPiece(&xs[0], (int32_t)global_x_pos, 0);
+        FormatObjTextPiece(&xs[1], (int32_t)(global_x_pos + tile_size), 0);
+        FormatObjTextPiece(&ys[0], (int32_t)global_y_pos, 0);
+        FormatObjTextPiece(&ys[1], (int32_t)(global_y_pos + tile_size), 0);
+        for (uint32_t corner = 0; corner < 4; corner++) {
+          FormatObjTextPiece(&indices[corner], (int32_t)(vert_c + corner), 0);
+        }
+        // The variant trails the colour, readers of the older format stop
+        // after the colour and never see it.
+        tail.length = 0;
+        for (uint32_t c = 0; c < 3; c++) {
+          FormatObjTextPiece(&tail, color[c], 1);
+        }
+        FormatObjTextPiece(&tail, chunk->variants[index], 1);
+        tail.text[tail.length++] = '\n';
+
+        // Corners go top left, top right, bottom left, bottom right.
+        *out++ = '\n';
+        for (uint32_t corner = 0; corner < 4; corner++) {
+          *out++ = 'v';
+          out = AppendObjTextPiece(out, &xs[corner & 1]);
+          out = AppendObjTextPiece(out, &ys[corner >> 1]);
+          out = AppendObjTextPiece(out, &tail);
+        }
+        static const uint8_t faces[2][3] = {{0, 1, 3}, {0, 2, 3}};
+        for (uint32_t face = 0; face < 2; face++) {
+          *out++ = 'i';
+          for (uint32_t c = 0; c < 3; c++) {
+            out = AppendObjTextPiece(out, &indices[faces[face][c]]);
+          }
+          *out++ = '\n';
+        }
+        CommitText(pWriter, out);
+        vert_c += 4;
+      }
+    }
+  }
+  *pVert_count = vert_c;
+}
+
+/*
+Newline search is most of what a text load does, so text is scanned 16 bytes
+at a time where SSE2 is there, the tail and other targets go through memchr.
+*/
+static const char *FindLineEnd(const char *cursor, const char *end) {
+#if defined(__SSE2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  while (end - cursor >= 16) {
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)cursor), newline));
+    if (mask) {
+      return cursor + __builtin_ctz(mask);
+    }
+    cursor += 16;
+  }
+#endif
+  const char *newline_ptr = memchr(cursor, '\n', end - cursor);
+
+  return newline_ptr ? newline_ptr : end;
+}
+
+/*
+Start of the line after the next count newlines, or end. Newlines are counted
+off a block at a time instead of searching for each line end in turn.
+*/
+static const char *SkipLines(const char *cursor, const char *end,
+                             uint32_t count) {
+#if defined(__SSE2__)
+  const __m128i newline = _mm_set1_epi8('\n');
+  while (count && end - cursor >= 16) {
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)cursor), newline));
+    for (; mask; mask &= mask - 1) {
+      if (!--count) {
+        return cursor + __builtin_ctz(mask) + 1;
+      }
+    }
+    cursor += 16;
+  }
+#endif
+  for (; count && cursor < end; count--) {
+    cursor = FindLineEnd(cursor, end);
+    cursor += (cursor < end);
+  }
+
+  return cursor;
+}
+
+/*
+Reads one decimal integer, skipping blanks before it, and moves the cursor
+past it. Values outside int32_t are refused rather than wrapped.
+*/
+static Enum_StatusCodes ParseDecimal(const char **pCursor, const char *end,
+                                     int32_t *pValue) {
+  const char *cursor = *pCursor;
+  uint8_t negative = 0;
+  int64_t value = 0;
+
+  while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+    cursor++;
+  }
+  if (cursor < end && (*cursor == '-' || *cursor == '+')) {
+    negative = *cursor++ == '-';
+  }
+  const char *digits = cursor;
+  while (cursor < end && (uint8_t)(*cursor - '0') < 10) {
+    value = value * 10 + (*cursor++ - '0');
+    if (value > (int64_t)INT32_MAX + 1) {
+      return FAILURE;
+    }
+  }
+  // A number ends at a blank or the end of its line.
+  if (cursor == digits ||
+      (cursor < end && *cursor != ' ' && *cursor != '\t' &&
+       *cursor != '\r' && *cursor != '\n')) {
+    return FAILURE;
+  }
+  value = negative ? -value : value;
+  if (value > INT32_MAX) {
+    return FAILURE;
+  }
+  *pValue = (int32_t)value;
+  *pCursor = cursor;
+
+  return SUCCESS;
+}
+
+/*
+Reads the values of the "v" line at *pCursor without looking for its end
+first, leaving the cursor right after the colour. Anything after it, like the
+variant, is not needed to rebuild the tile.
+*/
+static Enum_StatusCodes ParseVDataLine(const char **pCursor, const char *end,
+                                       uint32_t tile_size,
+                                       Struct_TileHashNode *pDest) {
+  Enum_StatusCodes status = SUCCESS;
+  const char *line = *pCursor, *cursor = &line[2];
+  int32_t values[PERLINE_ATTR_COUNT];
+
+  for (uint32_t i = 0; i < PERLINE_ATTR_COUNT; i++) {
+    if (ParseDecimal(&cursor, end, &values[i]) != SUCCESS) {
+      char logged_line[MAX_LOGGED_LINE_SIZE];
+      const char *line_end = FindLineEnd(line, end);
+      snprintf(logged_line, sizeof(logged_line), "%.*s",
+               (int32_t)((line_end - line < MAX_LOGGED_LINE_SIZE)
+                             ? line_end - line
+                             : MAX_LOGGED_LINE_SIZE - 1),
+               line);
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, logged_line, OUTPUT_LOG_STREAM);
+      return status;
+    }
+  }
+  *pCursor = cursor;
+
+  // Signed division, dividing by the unsigned tile_size mangles negatives.
+  *pDest = (Struct_TileHashNode){.x = values[0] / (int32_t)tile_size,
+                                 .y = values[1] / (int32_t)tile_size,
+                                 .r = values[2],
+                                 .g = values[3],
+                                 .b = values[4]};
+
+  return status;
+}
+
+Enum_StatusCodes ParseFileToData(Struct_TileHashMap *pTile_hash_map,
+                                 const char *file_path, uint32_t tile_size) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_ParsedText parsed;
+  const void *data;
+  size_t size, line_length;
+  const char *line;
+
+  if ((status = MapFile(file_path, &data, &size)) != SUCCESS || !size) {
+    return status;
+  }
+
+  // Every object of the file goes into the same map, anything else is skipped.
+  ParseTextInParallel(data, (const char *)data + size, tile_size, &parsed);
+  do {
+    status = MergeParsedText(&parsed, pTile_hash_map, &line, &line_length);
+  } while (status == SUCCESS && line_length);
+  FreeParsedText(&parsed);
+  UnmapFile(data, size);
+
+  return status;
+}
+
+/*
+Reads tiles from *pCursor into the batch until it is full, the text runs out
+or a line that is not part of a tile comes up, handed back as ParseTextToData
+does. The batch is only allocated once a tile shows up, so stopping right away
+costs nothing.
+*/
+static Enum_StatusCodes ScanTextTiles(const char **pCursor, const char *end,
+                                      uint32_t tile_size,
+                                      Struct_TileHashNode **pBatch,
+                                      uint32_t *pBatch_count,
+                                      const char **pLine,
+                                      size_t *pLine_length) {
+  Enum_StatusCodes status = SUCCESS;
+  const char *cursor = *pCursor;
+  uint32_t batch_count = 0;
+
+  *pLine_length = 0;
+  while (cursor < end && batch_count < PARSE_BATCH_SIZE) {
+    // Each rect starts with a blank line, by far the most common one.
+    if (*cursor == '\n') {
+      cursor++;
+      continue;
+    }
+    if (end - cursor >= 2 && cursor[0] == 'v' && cursor[1] == ' ') {
+      if (!*pBatch && !(*pBatch = malloc(PARSE_BATCH_SIZE *
+                                         sizeof(Struct_TileHashNode)))) {
+        status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+        Logger(&status, NULL, "Error produced by ScanTextTiles()",
+               OUTPUT_LOG_STREAM);
+        break;
+      }
+      if ((status = ParseVDataLine(&cursor, end, tile_size,
+                                   &(*pBatch)[batch_count++])) != SUCCESS) {
+        break;
+      }
+      /*
+      Skipping the rest of the line and the other vertices and indices that
+      makeup the rect, the first vertex is all it takes to rebuild it. Assuming
+      data correctness. The blank line before the next rect is left to the
+      loop, another line may be there.
+      */
+      cursor = SkipLines(cursor, end, LINES_PER_RECT);
+      continue;
+    }
+
+    const char *line = cursor, *line_end = FindLineEnd(cursor, end);
+    cursor = (line_end < end) ? line_end + 1 : end;
+    if (line[0] != '\r' && line[0] != '#' && line[0] != 'i') {
+      // Not part of a tile, so it is the caller's.
+      *pLine = line;
+      *pLine_length = (line_end[-1] == '\r') ? line_end - line - 1
+                                              : line_end - line;
+      break;
+    }
+  }
+  *pCursor = cursor;
+  *pBatch_count = batch_count;
+
+  return status;
+}
+
+Enum_StatusCodes ParseTextToData(Struct_TileHashMap *pTile_hash_map,
+                                 const char **pCursor, const char *end,
+                                 uint32_t tile_size, const char **pLine,
+                                 size_t *pLine_length) {
+  Enum_StatusCodes status = SUCCESS;
+  /*
+  Tiles are handed to the map in batches, which lets it reserve ahead and
+  reuse chunk lookups between neighbours, without buffering a whole large file.
+  */
+  Struct_TileHashNode *batch = NULL;
+  uint32_t batch_count;
+
+  // One transaction, so variants are worked out once for the whole map.
+  BeginTileTransaction(pTile_hash_map);
+  do {
+    if ((status = ScanTextTiles(pCursor, end, tile_size, &batch, &batch_count,
+                                pLine, pLine_length)) == SUCCESS) {
+      status =
+          AddTileHashMapEntries(batch, batch_count, 0, pTile_hash_map);
+    }
+  } while (status == SUCCESS && batch_count == PARSE_BATCH_SIZE);
+  CommitTileTransaction(pTile_hash_map);
+  free(batch);
+
+  return status;
+}
+
+/*
+Start of the first blank line after the one cursor is in, or end. Rects are
+always preceded by one and never hold one, so a reader starting there is in
+step with one that came all the way from the start of the text.
+*/
+static const char *FindRangeStart(const char *cursor, const char *end) {
+  for (cursor = FindLineEnd(cursor, end); cursor < end;
+       cursor = FindLineEnd(cursor, end)) {
+    cursor++;
+    if (cursor < end &&
+        (*cursor == '\n' ||
+         (*cursor == '\r' && end - cursor >= 2 && cursor[1] == '\n'))) {
+      return cursor;
+    }
+  }
+
+  return end;
+}
+
+/*
+Runs work on every job, one thread each but the first, which the caller runs
+itself, as it does any job a thread could not be started for.
+*/
+static void RunInParallel(void *(*work)(void *), void *jobs, size_t job_size,
+                          uint32_t job_count) {
+  pthread_t threads[PARSE_MAX_THREADS];
+  uint8_t started[PARSE_MAX_THREADS] = {0};
+
+  for (uint32_t i = 1; i < job_count; i++) {
+    started[i] = !pthread_create(&threads[i], NULL, work,
+                                 (uint8_t *)jobs + i * job_size);
+  }
+  work(jobs);
+  for (uint32_t i = 1; i < job_count; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      work((uint8_t *)jobs + i * job_size);
+    }
+  }
+}
+
+/*
+Worker of ParseTextInParallel. Its maps are never committed, variants are
+only worked out once the tiles are merged next to those of the other ranges.
+*/
+static void *ParseTextRange(void *pData) {
+  Struct_ParsedTextRange *pRange = pData;
+  Enum_StatusCodes status = SUCCESS;
+  Struct_TileHashNode *batch = NULL;
+  uint32_t batch_count;
+  Struct_ParsedTextSegment *segment = NULL;
+  const char *cursor = pRange->begin;
+
+  while (cursor < pRange->end && status == SUCCESS) {
+    if (!segment || segment->line) {
+      if (pRange->segment_count == pRange->segments_capacity) {
+        uint32_t capacity = pRange->segments_capacity
+                                ? pRange->segments_capacity * 2
+                                : PARSE_INITIAL_SEGMENTS;
+        Struct_ParsedTextSegment *segments = realloc(
+            pRange->segments, capacity * sizeof(Struct_ParsedTextSegment));
+        if (!segments) {
+          status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+          Logger(&status, NULL, "Error produced by ParseTextRange()",
+                 OUTPUT_LOG_STREAM);
+          break;
+        }
+        pRange->segments = segments;
+        pRange->segments_capacity = capacity;
+      }
+      segment = &pRange->segments[pRange->segment_count++];
+      *segment = (Struct_ParsedTextSegment){0};
+    }
+
+    if ((status = ScanTextTiles(&cursor, pRange->end, pRange->tile_size,
+                                &batch, &batch_count, &segment->line,
+                                &segment->line_length)) != SUCCESS) {
+      break;
+    }
+    if (batch_count && !segment->has_tiles) {
+      if ((status = InitTileHashMap(&segment->tile_hash_map)) != SUCCESS) {
+        break;
+      }
+      segment->has_tiles = 1;
+      BeginTileTransaction(&segment->tile_hash_map);
+    }
+    if (batch_count) {
+      status = AddTileHashMapEntries(batch, batch_count, 0,
+                                     &segment->tile_hash_map);
+    }
+  }
+  free(batch);
+  pRange->status = status;
+
+  return NULL;
+}
+
+void ParseTextInParallel(const char *text, const char *end,
+                         uint32_t tile_size, Struct_ParsedText *pParsed) {
+  size_t size = end - text;
+  uint32_t range_count = GetProcessorCount();
+
+  if (range_count > PARSE_MAX_THREADS) {
+    range_count = PARSE_MAX_THREADS;
+  }
+  if (range_count > size / PARSE_MIN_RANGE_SIZE) {
+    range_count = (size >= PARSE_MIN_RANGE_SIZE)
+                      ? (uint32_t)(size / PARSE_MIN_RANGE_SIZE)
+                      : 1;
+  }
+
+  *pParsed = (Struct_ParsedText){.range_count = range_count};
+  const char *begin = text;
+  for (uint32_t i = 0; i < range_count; i++) {
+    const char *range_end =
+        (i + 1 < range_count)
+            ? FindRangeStart(text + size / range_count * (i + 1), end)
+            : end;
+    // A range swallowed by a long run without blank lines is left empty.
+    range_end = (range_end < begin) ? begin : range_end;
+    pParsed->ranges[i] = (Struct_ParsedTextRange){
+        .begin = begin, .end = range_end, .tile_size = tile_size};
+    begin = range_end;
+  }
+
+  RunInParallel(ParseTextRange, pParsed->ranges, sizeof(Struct_ParsedTextRange),
+                range_count);
+}
+
+Enum_StatusCodes MergeParsedText(Struct_ParsedText *pParsed,
+                                 Struct_TileHashMap *pTile_hash_map,
+                                 const char **pLine, size_t *pLine_length) {
+  Enum_StatusCodes status = SUCCESS;
+
+  *pLine_length = 0;
+  // One transaction, so variants are worked out once for the whole map.
+  BeginTileTransaction(pTile_hash_map);
+  while (pParsed->range_index < pParsed->range_count) {
+    Struct_ParsedTextRange *pRange = &pParsed->ranges[pParsed->range_index];
+    if (pParsed->segment_index == pRange->segment_count) {
+      if ((status = pRange->status) != SUCCESS) {
+        break;
+      }
+      pParsed->range_index++;
+      pParsed->segment_index = 0;
+      continue;
+    }
+
+    Struct_ParsedTextSegment *segment =
+        &pRange->segments[pParsed->segment_index++];
+    if (segment->has_tiles) {
+      status = AdoptTileHashMap(&segment->tile_hash_map, pTile_hash_map);
+      // Not needed anymore, the memory is better off back with the system.
+      FreeTileHashMap(&segment->tile_hash_map);
+      segment->has_tiles = 0;
+      if (status != SUCCESS) {
+        break;
+      }
+    }
+    if (segment->line) {
+      *pLine = segment->line;
+      *pLine_length = segment->line_length;
+      break;
+    }
+  }
+  // Only the outermost commit works variants out, so only then are they here.
+  if (pTile_hash_map->transaction_depth == 1) {
+    UpdateVariantsInParallel(pTile_hash_map);
+  }
+  CommitTileTransaction(pTile_hash_map);
+
+  return status;
+}
+
+void FreeParsedText(Struct_ParsedText *pParsed) {
+  for (uint32_t i = 0; i < pParsed->range_count; i++) {
+    Struct_ParsedTextRange *pRange = &pParsed->ranges[i];
+    for (uint32_t j = 0; j < pRange->segment_count; j++) {
+      if (pRange->segments[j].has_tiles) {
+        FreeTileHashMap(&pRange->segments[j].tile_hash_map);
+      }
+    }
+    free(pRange->segments);
+  }
+  *pParsed = (Struct_ParsedText){0};
+}
+
+static Enum_StatusCodes DumpChunkBinary(const Struct_TileChunk *chunk,
+                                        FILE *file) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_BinaryChunkHeader header = {
+      .chunk_x = chunk->chunk_x, .chunk_y = chunk->chunk_y,
+      .count = chunk->count};
+  uint8_t sparse = chunk->count <= BINARY_SPARSE_CHUNK_LIMIT;
+  uint16_t records[TILE_CHUNK_AREA];
+  uint32_t record_count = 0;
+
+  for (uint32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+    uint32_t row_bits = chunk->occupied[row];
+    while (row_bits) {
+      uint32_t index = row * TILE_CHUNK_SIZE + __builtin_ctz(row_bits);
+      row_bits &= row_bits - 1;
+      if (sparse) {
+        records[record_count++] = index;
+      }
+      records[record_count++] = chunk->cells[index];
+    }
+  }
+
+  if ((status = WriteBinary(&header, sizeof(header), file)) != SUCCESS ||
+      (!sparse && (status = WriteBinary(chunk->occupied,
+                                        sizeof(chunk->occupied), file)) !=
+                      SUCCESS)) {
+    return status;
+  }
+
+  return WriteBinary(records, record_count * sizeof(uint16_t), file);
+}
+
+static Enum_StatusCodes LoadChunkBinary(const uint8_t **pCursor,
+                                        const uint8_t *end,
+                                        const uint16_t *remap,
+                                        uint32_t palette_count,
+                                        Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  Struct_BinaryChunkHeader header;
+  const void *occupied = NULL, *data;
+  uint32_t rows[TILE_CHUNK_SIZE] = {0};
+
+  if (ReadBinary(&header, sizeof(header), pCursor, end) != SUCCESS ||
+      !header.count || header.count > TILE_CHUNK_AREA ||
+      header.chunk_x < (INT32_MIN >> TILE_CHUNK_SHIFT) ||
+      header.chunk_x > (INT32_MAX >> TILE_CHUNK_SHIFT) ||
+      header.chunk_y < (INT32_MIN >> TILE_CHUNK_SHIFT) ||
+      header.chunk_y > (INT32_MAX >> TILE_CHUNK_SHIFT)) {
+    return FAILURE;
+  }
+  uint8_t sparse = header.count <= BINARY_SPARSE_CHUNK_LIMIT;
+  if ((!sparse &&
+       MapBinary(&occupied, sizeof(rows), pCursor, end) != SUCCESS) ||
+      MapBinary(&data, (size_t)header.count * (sparse ? 2 : 1) *
+                           sizeof(uint16_t),
+                pCursor, end) != SUCCESS) {
+    return FAILURE;
+  }
+  const uint16_t *records = data;
+
+  // Checked in full before the map is touched, a bad record changes nothing.
+  if (sparse) {
+    for (uint32_t i = 0; i < header.count; i++) {
+      uint32_t index = records[2 * i];
+      if (index >= TILE_CHUNK_AREA || records[2 * i + 1] >= palette_count ||
+          HAS_FLAG(rows[index >> TILE_CHUNK_SHIFT],
+                   1U << (index & TILE_CHUNK_MASK))) {
+        return FAILURE;
+      }
+      rows[index >> TILE_CHUNK_SHIFT] |= 1U << (index & TILE_CHUNK_MASK);
+    }
+  } else {
+    uint32_t total = 0;
+    memcpy(rows, occupied, sizeof(rows));
+    for (uint32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+      total += __builtin_popcount(rows[row]);
+    }
+    for (uint32_t i = 0; i < header.count; i++) {
+      if (records[i] >= palette_count) {
+        return FAILURE;
+      }
+    }
+    if (total != header.count) {
+      return FAILURE;
+    }
+  }
+
+  MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+  Struct_TileChunk *chunk =
+      FindChunk(pTile_hash_map, header.chunk_x, header.chunk_y);
+  if (chunk ? (status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS
+            : (status = CreateChunk(header.chunk_x, header.chunk_y,
+                                    pTile_hash_map, &chunk)) != SUCCESS) {
+    return status;
+  }
+
+  if (sparse) {
+    for (uint32_t i = 0; i < header.count; i++) {
+      chunk->cells[records[2 * i]] = remap[records[2 * i + 1]];
+    }
+  } else {
+    for (uint32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+      uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+      uint32_t row_bits = rows[row];
+      while (row_bits) {
+        cells[__builtin_ctz(row_bits)] = remap[*records++];
+        row_bits &= row_bits - 1;
+      }
+    }
+  }
+
+  AddChunkRows(chunk, rows, pTile_hash_map);
+
+  return status;
+}
+
+/*
+Accounts for the tiles of rows that were just written into the chunk's cells,
+occupied or not before, as one change to the map.
+*/
+static void AddChunkRows(Struct_TileChunk *chunk,
+                         const uint32_t rows[TILE_CHUNK_SIZE],
+                         Struct_TileHashMap *pTile_hash_map) {
+  uint32_t first_row = TILE_CHUNK_SIZE, last_row = 0, cols = 0, added = 0;
+
+  for (uint32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+    if (!rows[row]) {
+      continue;
+    }
+    first_row = (row < first_row) ? row : first_row;
+    last_row = row;
+    cols |= rows[row];
+    added += __builtin_popcount(rows[row] & ~chunk->occupied[row]);
+    chunk->occupied[row] |= rows[row];
+  }
+  if (!cols) {
+    return;
+  }
+  chunk->count += added;
+
+  int32_t start_x = chunk->chunk_x * TILE_CHUNK_SIZE,
+          start_y = chunk->chunk_y * TILE_CHUNK_SIZE;
+  int32_t min_x = start_x + __builtin_ctz(cols),
+          max_x = start_x + TILE_CHUNK_MASK - __builtin_clz(cols),
+          min_y = start_y + first_row, max_y = start_y + last_row;
+  // Same order as in WriteChunkBlock, ExpandBounds restarts on an empty map.
+  ExpandBounds(min_x, min_y, pTile_hash_map);
+  pTile_hash_map->tile_count += added;
+  ExpandBounds(max_x, max_y, pTile_hash_map);
+  MarkReshaped(min_x, min_y, max_x, max_y, pTile_hash_map);
+}
+
+/*
+Moves every tile of pSource over, overwriting those already in the map, and
+leaves pSource good for FreeTileHashMap only. Its slabs are handed over whole,
+so chunks the map does not hold yet are listed as they are rather than copied,
+with their palette indices remapped in place if need be.
+*/
+static Enum_StatusCodes AdoptTileHashMap(Struct_TileHashMap *pSource,
+                                         Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  const Struct_TilePalette *palette = &pSource->palette;
+  uint8_t same_palette = 1;
+
+  uint16_t *remap = malloc((palette->count ? palette->count : 1) *
+                           sizeof(uint16_t));
+  if (!remap) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by AdoptTileHashMap()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS ||
+      (status = ReserveTileHashMap(pSource->chunk_count, pTile_hash_map)) !=
+          SUCCESS) {
+    free(remap);
+    return status;
+  }
+  for (uint32_t i = 0; i < palette->count && status == SUCCESS; i++) {
+    status = InternPaletteColor(palette->colors[i][0], palette->colors[i][1],
+                                palette->colors[i][2],
+                                &pTile_hash_map->palette, &remap[i]);
+    same_palette &= remap[i] == i;
+  }
+  if (status != SUCCESS) {
+    free(remap);
+    return status;
+  }
+
+  // Behind the newest slab, whose unused chunks are still being handed out.
+  if (pSource->slabs) {
+    Struct_TileChunkSlab *last = pSource->slabs;
+    while (last->next) {
+      last = last->next;
+    }
+    if (pTile_hash_map->slabs) {
+      last->next = pTile_hash_map->slabs->next;
+      pTile_hash_map->slabs->next = pSource->slabs;
+    } else {
+      pTile_hash_map->slabs = pSource->slabs;
+      pTile_hash_map->slab_used = pSource->slab_used;
+    }
+    pSource->slabs = NULL;
+  }
+
+  BeginTileTransaction(pTile_hash_map);
+  for (uint32_t i = 0; i < pSource->chunk_count && status == SUCCESS; i++) {
+    Struct_TileChunk *source = pSource->chunks[i];
+    uint32_t rows[TILE_CHUNK_SIZE];
+    memcpy(rows, source->occupied, sizeof(rows));
+    if (!same_palette) {
+      for (uint32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+        uint16_t *cells = &source->cells[row * TILE_CHUNK_SIZE];
+        for (uint32_t row_bits = rows[row]; row_bits;
+             row_bits &= row_bits - 1) {
+          uint32_t col = __builtin_ctz(row_bits);
+          cells[col] = remap[cells[col]];
+        }
+      }
+    }
+
+    MigrateTileHashMap(pTile_hash_map, HASH_MIGRATE_STEP);
+    Struct_TileChunk *chunk =
+        FindChunk(pTile_hash_map, source->chunk_x, source->chunk_y);
+    if (!chunk) {
+      // Counted again below, as tiles new to the map.
+      memset(source->occupied, 0, sizeof(source->occupied));
+      source->count = 0;
+      if ((status = InsertChunk(source, pTile_hash_map)) == SUCCESS) {
+        AddChunkRows(source, rows, pTile_hash_map);
+      }
+      continue;
+    }
+    if ((status = UnshareChunk(pTile_hash_map, &chunk)) != SUCCESS) {
+      break;
+    }
+    for (uint32_t row = 0; row < TILE_CHUNK_SIZE; row++) {
+      const uint16_t *from = &source->cells[row * TILE_CHUNK_SIZE];
+      uint16_t *cells = &chunk->cells[row * TILE_CHUNK_SIZE];
+      for (uint32_t row_bits = rows[row]; row_bits;
+           row_bits &= row_bits - 1) {
+        uint32_t col = __builtin_ctz(row_bits);
+        cells[col] = from[col];
+      }
+    }
+    AddChunkRows(chunk, rows, pTile_hash_map);
+    ReleaseChunk(pTile_hash_map, source);
+  }
+  CommitTileTransaction(pTile_hash_map);
+  free(remap);
+
+  return status;
+}
+
+Enum_StatusCodes DumpTileHashMapBinary(const Struct_TileHashMap *pTile_hash_map,
+                                       FILE *file) {
+  Enum_StatusCodes status = SUCCESS;
+  const Struct_TilePalette *palette = &pTile_hash_map->palette;
+  uint32_t header[4] = {palette->count, pTile_hash_map->chunk_count,
+                        pTile_hash_map->tile_count, 0};
+
+  status = WriteBinary(header, sizeof(header), file);
+  for (uint32_t i = 0; i < palette->count && status == SUCCESS; i++) {
+    uint8_t color[4] = {palette->colors[i][0], palette->colors[i][1],
+                        palette->colors[i][2], 0};
+    status = WriteBinary(color, sizeof(color), file);
+  }
+  for (uint32_t i = 0; i < pTile_hash_map->chunk_count && status == SUCCESS;
+       i++) {
+    status = DumpChunkBinary(pTile_hash_map->chunks[i], file);
+  }
+  if (status != SUCCESS) {
+    Logger(&status, NULL, "Error produced by DumpTileHashMapBinary()",
+           OUTPUT_LOG_STREAM);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes LoadTileHashMapBinary(const uint8_t **pCursor,
+                                       const uint8_t *end,
+                                       Struct_TileHashMap *pTile_hash_map) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t header[4];
+  const void *colors_data;
+  uint32_t initial_tile_count = pTile_hash_map->tile_count;
+
+  /*
+  A chunk record takes at least 16 bytes, so a chunk count the rest of the file
+  cannot hold is refused before anything is reserved for it.
+  */
+  if (ReadBinary(header, sizeof(header), pCursor, end) != SUCCESS ||
+      header[0] > TILE_PALETTE_MAX_COLORS ||
+      MapBinary(&colors_data, (size_t)header[0] * 4, pCursor, end) !=
+          SUCCESS ||
+      header[1] > (size_t)(end - *pCursor) / 16) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by LoadTileHashMapBinary()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  const uint8_t(*colors)[4] = colors_data;
+
+  uint16_t *remap = malloc((header[0] ? header[0] : 1) * sizeof(uint16_t));
+  if (!remap) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by LoadTileHashMapBinary()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  if ((status = UnshareTileHashMap(pTile_hash_map)) != SUCCESS ||
+      (status = ReserveTileHashMap(header[1], pTile_hash_map)) != SUCCESS) {
+    free(remap);
+    return status;
+  }
+  for (uint32_t i = 0; i < header[0] && status == SUCCESS; i++) {
+    status = InternPaletteColor(colors[i][0], colors[i][1], colors[i][2],
+                                &pTile_hash_map->palette, &remap[i]);
+  }
+
+  // One transaction, so variants are worked out once for the whole map.
+  BeginTileTransaction(pTile_hash_map);
+  for (uint32_t i = 0; i < header[1] && status == SUCCESS; i++) {
+    if ((status = LoadChunkBinary(pCursor, end, remap, header[0],
+                                  pTile_hash_map)) == FAILURE) {
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by LoadTileHashMapBinary()",
+             OUTPUT_LOG_STREAM);
+    }
+  }
+  CommitTileTransaction(pTile_hash_map);
+  free(remap);
+
+  // Loaded into an empty map, the tiles must add up to the saved count.
+  if (status == SUCCESS && !initial_tile_count &&
+      pTile_hash_map->tile_count != header[2]) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by LoadTileHashMapBinary()",
+           OUTPUT_LOG_STREAM);
+  }
+
+  return status;
 }
\ No newline at end of file
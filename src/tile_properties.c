@@ -0,0 +1,594 @@
+#include "../include/tile_properties.h"
+#include "../include/tile_map_manager.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 2166136261U
+#define FNV_PRIME 16777619U
+#define PROPERTY_KEY_MULTIPLIER 3266489917U
+
+#define STRING_POOL_INITIAL_CAPACITY 16
+#define STRING_CHARS_INITIAL_CAPACITY 256
+#define PROPERTY_TABLE_INITIAL_CAPACITY 16
+
+static uint32_t HashString(const char *string);
+static uint32_t HashProperty(int32_t x, int32_t y, uint32_t key);
+static void InsertStringLookup(Struct_StringPool *pString_pool, uint32_t id);
+static Enum_StatusCodes GrowStringPool(Struct_StringPool *pString_pool);
+static Enum_StatusCodes FindPropertySlot(int32_t x, int32_t y, uint32_t key,
+                                         const Struct_TilePropertyTable
+                                             *pProperty_table,
+                                         uint32_t *pSlot);
+static void InsertPropertyIndex(Struct_TilePropertyTable *pProperty_table,
+                                uint32_t position);
+static Enum_StatusCodes
+GrowTilePropertyTable(Struct_TilePropertyTable *pProperty_table);
+static Enum_StatusCodes ParseLineNumber(char **pCursor, int64_t *pDest);
+static Enum_StatusCodes
+LoadedStringId(uint64_t file_id, const Struct_TilePropertyLoader *pLoader,
+               uint32_t *pId);
+
+// FNV-1a, strings here are short and hashed once per intern or find.
+static uint32_t HashString(const char *string) {
+  uint32_t hash = FNV_OFFSET_BASIS;
+
+  for (; *string; string++) {
+    hash = (hash ^ (uint8_t)*string) * FNV_PRIME;
+  }
+
+  return hash;
+}
+
+static uint32_t HashProperty(int32_t x, int32_t y, uint32_t key) {
+  return MixHashBits((uint32_t)x * KNUTHS_X_MULTIPLIER ^
+                     (uint32_t)y * KNUTHS_Y_MULTIPLIER ^
+                     key * PROPERTY_KEY_MULTIPLIER);
+}
+
+static void InsertStringLookup(Struct_StringPool *pString_pool, uint32_t id) {
+  uint32_t mask = pString_pool->lookup_capacity - 1;
+  uint32_t i =
+      HashString(&pString_pool->chars[pString_pool->offsets[id]]) & mask;
+
+  while (pString_pool->lookup[i]) {
+    i = (i + 1) & mask;
+  }
+  pString_pool->lookup[i] = id + 1;
+}
+
+static Enum_StatusCodes GrowStringPool(Struct_StringPool *pString_pool) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t capacity = pString_pool->capacity ? pString_pool->capacity * 2
+                                             : STRING_POOL_INITIAL_CAPACITY;
+
+  uint32_t *offsets =
+      realloc(pString_pool->offsets, capacity * sizeof(uint32_t));
+  // Lookup is kept at most half full so linear probing stays short.
+  uint32_t *lookup = calloc(capacity * 2, sizeof(uint32_t));
+  if (!offsets || !lookup) {
+    if (offsets) {
+      pString_pool->offsets = offsets;
+    }
+    free(lookup);
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by GrowStringPool()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  free(pString_pool->lookup);
+  pString_pool->offsets = offsets;
+  pString_pool->capacity = capacity;
+  pString_pool->lookup = lookup;
+  pString_pool->lookup_capacity = capacity * 2;
+  for (uint32_t i = 0; i < pString_pool->count; i++) {
+    InsertStringLookup(pString_pool, i);
+  }
+
+  return status;
+}
+
+// pSlot gets where the property is, or the empty slot it would go in.
+static Enum_StatusCodes FindPropertySlot(int32_t x, int32_t y, uint32_t key,
+                                         const Struct_TilePropertyTable
+                                             *pProperty_table,
+                                         uint32_t *pSlot) {
+  uint32_t mask = pProperty_table->index_capacity - 1;
+  uint32_t i = HashProperty(x, y, key) & mask;
+
+  for (; pProperty_table->index[i]; i = (i + 1) & mask) {
+    const Struct_TileProperty *property =
+        &pProperty_table->properties[pProperty_table->index[i] - 1];
+    if (property->x == x && property->y == y && property->key == key) {
+      *pSlot = i;
+      return SUCCESS;
+    }
+  }
+  *pSlot = i;
+
+  return FAILURE;
+}
+
+static void InsertPropertyIndex(Struct_TilePropertyTable *pProperty_table,
+                                uint32_t position) {
+  const Struct_TileProperty *property =
+      &pProperty_table->properties[position];
+  uint32_t slot;
+
+  FindPropertySlot(property->x, property->y, property->key, pProperty_table,
+                   &slot);
+  pProperty_table->index[slot] = position + 1;
+}
+
+static Enum_StatusCodes
+GrowTilePropertyTable(Struct_TilePropertyTable *pProperty_table) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t capacity = pProperty_table->capacity
+                          ? pProperty_table->capacity * 2
+                          : PROPERTY_TABLE_INITIAL_CAPACITY;
+
+  Struct_TileProperty *properties = realloc(
+      pProperty_table->properties, capacity * sizeof(Struct_TileProperty));
+  uint32_t *index = calloc(capacity * 2, sizeof(uint32_t));
+  if (!properties || !index) {
+    if (properties) {
+      pProperty_table->properties = properties;
+    }
+    free(index);
+    status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by GrowTilePropertyTable()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  free(pProperty_table->index);
+  pProperty_table->properties = properties;
+  pProperty_table->capacity = capacity;
+  pProperty_table->index = index;
+  pProperty_table->index_capacity = capacity * 2;
+  for (uint32_t i = 0; i < pProperty_table->count; i++) {
+    InsertPropertyIndex(pProperty_table, i);
+  }
+
+  return status;
+}
+
+// Reads one space separated integer and moves the cursor past it.
+static Enum_StatusCodes ParseLineNumber(char **pCursor, int64_t *pDest) {
+  char *end_ptr;
+
+  *pDest = strtoll(*pCursor, &end_ptr, 10);
+  if (end_ptr == *pCursor || (*end_ptr != ' ' && *end_ptr != '\0')) {
+    return FAILURE;
+  }
+  *pCursor = (*end_ptr == ' ') ? end_ptr + 1 : end_ptr;
+
+  return SUCCESS;
+}
+
+static Enum_StatusCodes
+LoadedStringId(uint64_t file_id, const Struct_TilePropertyLoader *pLoader,
+               uint32_t *pId) {
+  if (file_id >= pLoader->capacity || !pLoader->string_ids[file_id]) {
+    return FAILURE;
+  }
+  *pId = pLoader->string_ids[file_id] - 1;
+
+  return SUCCESS;
+}
+
+void InitStringPool(Struct_StringPool *pString_pool) {
+  *pString_pool = (Struct_StringPool){0};
+}
+
+void FreeStringPool(Struct_StringPool *pString_pool) {
+  free(pString_pool->chars);
+  free(pString_pool->offsets);
+  free(pString_pool->lookup);
+  *pString_pool = (Struct_StringPool){0};
+}
+
+Enum_StatusCodes InternString(const char *string,
+                              Struct_StringPool *pString_pool,
+                              uint32_t *pId) {
+  Enum_StatusCodes status = SUCCESS;
+  size_t length = strlen(string);
+
+  if (FindInternedString(string, pString_pool, pId) == SUCCESS) {
+    return status;
+  }
+
+  // A newline would end the string early once saved.
+  if (length > TILE_PROPERTY_STRING_LIMIT || strchr(string, '\n')) {
+    status = INVALID_FUNCTION_INPUT | LOW_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by InternString()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  if (pString_pool->count == pString_pool->capacity &&
+      (status = GrowStringPool(pString_pool)) != SUCCESS) {
+    return status;
+  }
+  if (pString_pool->chars_size + length + 1 > pString_pool->chars_capacity) {
+    size_t chars_capacity = pString_pool->chars_capacity
+                                ? pString_pool->chars_capacity
+                                : STRING_CHARS_INITIAL_CAPACITY;
+    while (pString_pool->chars_size + length + 1 > chars_capacity) {
+      chars_capacity *= 2;
+    }
+    char *chars = (chars_capacity > UINT32_MAX)
+                      ? NULL
+                      : realloc(pString_pool->chars, chars_capacity);
+    if (!chars) {
+      status = MEM_ALLOC_FAILURE | LOW_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by InternString()",
+             OUTPUT_LOG_STREAM);
+      return status;
+    }
+    pString_pool->chars = chars;
+    pString_pool->chars_capacity = chars_capacity;
+  }
+
+  *pId = pString_pool->count++;
+  pString_pool->offsets[*pId] = pString_pool->chars_size;
+  memcpy(&pString_pool->chars[pString_pool->chars_size], string, length + 1);
+  pString_pool->chars_size += length + 1;
+  InsertStringLookup(pString_pool, *pId);
+
+  return status;
+}
+
+Enum_StatusCodes FindInternedString(const char *string,
+                                    const Struct_StringPool *pString_pool,
+                                    uint32_t *pId) {
+  if (!pString_pool->lookup_capacity) {
+    return FAILURE;
+  }
+
+  uint32_t mask = pString_pool->lookup_capacity - 1;
+  for (uint32_t i = HashString(string) & mask; pString_pool->lookup[i];
+       i = (i + 1) & mask) {
+    uint32_t id = pString_pool->lookup[i] - 1;
+    if (!strcmp(&pString_pool->chars[pString_pool->offsets[id]], string)) {
+      *pId = id;
+      return SUCCESS;
+    }
+  }
+
+  return FAILURE;
+}
+
+const char *GetInternedString(uint32_t id,
+                              const Struct_StringPool *pString_pool) {
+  return (id < pString_pool->count)
+             ? &pString_pool->chars[pString_pool->offsets[id]]
+             : NULL;
+}
+
+void InitTilePropertyTable(Struct_TilePropertyTable *pProperty_table) {
+  *pProperty_table = (Struct_TilePropertyTable){0};
+}
+
+void FreeTilePropertyTable(Struct_TilePropertyTable *pProperty_table) {
+  free(pProperty_table->properties);
+  free(pProperty_table->index);
+  *pProperty_table = (Struct_TilePropertyTable){0};
+}
+
+Enum_StatusCodes SetTileProperty(int32_t x, int32_t y, uint32_t key,
+                                 uint32_t value,
+                                 Struct_TilePropertyTable *pProperty_table) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t slot;
+
+  if (pProperty_table->index_capacity &&
+      FindPropertySlot(x, y, key, pProperty_table, &slot) == SUCCESS) {
+    pProperty_table->properties[pProperty_table->index[slot] - 1].value =
+        value;
+    return status;
+  }
+
+  if (pProperty_table->count == pProperty_table->capacity &&
+      (status = GrowTilePropertyTable(pProperty_table)) != SUCCESS) {
+    return status;
+  }
+  pProperty_table->properties[pProperty_table->count] = (Struct_TileProperty){
+      .x = x, .y = y, .key = key, .value = value};
+  InsertPropertyIndex(pProperty_table, pProperty_table->count++);
+
+  return status;
+}
+
+Enum_StatusCodes
+GetTileProperty(int32_t x, int32_t y, uint32_t key,
+                const Struct_TilePropertyTable *pProperty_table,
+                uint32_t *pValue) {
+  uint32_t slot;
+
+  if (!pProperty_table->index_capacity ||
+      FindPropertySlot(x, y, key, pProperty_table, &slot) != SUCCESS) {
+    return FAILURE;
+  }
+  *pValue = pProperty_table->properties[pProperty_table->index[slot] - 1].value;
+
+  return SUCCESS;
+}
+
+Enum_StatusCodes
+RemoveTileProperty(int32_t x, int32_t y, uint32_t key,
+                   Struct_TilePropertyTable *pProperty_table) {
+  uint32_t slot, next;
+
+  if (!pProperty_table->index_capacity ||
+      FindPropertySlot(x, y, key, pProperty_table, &slot) != SUCCESS) {
+    return FAILURE;
+  }
+  uint32_t mask = pProperty_table->index_capacity - 1;
+  uint32_t position = pProperty_table->index[slot] - 1;
+
+  /*
+  Backward shift deletion, every entry after the hole that would no longer be
+  reachable from its home slot moves back into it.
+  */
+  for (next = (slot + 1) & mask; pProperty_table->index[next];
+       next = (next + 1) & mask) {
+    const Struct_TileProperty *property =
+        &pProperty_table->properties[pProperty_table->index[next] - 1];
+    uint32_t home =
+        HashProperty(property->x, property->y, property->key) & mask;
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      pProperty_table->index[slot] = pProperty_table->index[next];
+      slot = next;
+    }
+  }
+  pProperty_table->index[slot] = 0;
+
+  // Swap remove, the last property takes over the hole.
+  uint32_t last = --pProperty_table->count;
+  if (position != last) {
+    const Struct_TileProperty *moved = &pProperty_table->properties[last];
+    FindPropertySlot(moved->x, moved->y, moved->key, pProperty_table, &slot);
+    pProperty_table->index[slot] = position + 1;
+    pProperty_table->properties[position] = *moved;
+  }
+
+  return SUCCESS;
+}
+
+void DumpTilePropertiesToText(const Struct_TilePropertyTable *pProperty_table,
+                              const Struct_StringPool *pString_pool,
+                              Struct_TextWriter *pWriter,
+                              uint8_t *pString_written) {
+  for (uint32_t i = 0; i < pProperty_table->count; i++) {
+    const Struct_TileProperty *property = &pProperty_table->properties[i];
+    uint32_t ids[2] = {property->key, property->value};
+
+    // Strings are capped, so a line always fits in TILE_PROPERTY_LINE_SIZE.
+    for (uint32_t j = 0; j < 2; j++) {
+      if (pString_written[ids[j]]) {
+        continue;
+      }
+      pString_written[ids[j]] = 1;
+      const char *string = GetInternedString(ids[j], pString_pool);
+      size_t length = strlen(string);
+      char *out = ReserveText(pWriter, TILE_PROPERTY_LINE_SIZE);
+      if (!out) {
+        return;
+      }
+      *out++ = 's';
+      *out++ = ' ';
+      out = FormatDecimal(out, ids[j]);
+      *out++ = ' ';
+      memcpy(out, string, length);
+      out += length;
+      *out++ = '\n';
+      CommitText(pWriter, out);
+    }
+
+    char *out = ReserveText(pWriter, TILE_PROPERTY_LINE_SIZE);
+    if (!out) {
+      return;
+    }
+    int64_t values[4] = {property->x, property->y, property->key,
+                         property->value};
+    *out++ = 'p';
+    for (uint32_t j = 0; j < 4; j++) {
+      *out++ = ' ';
+      out = FormatDecimal(out, values[j]);
+    }
+    *out++ = '\n';
+    CommitText(pWriter, out);
+  }
+}
+
+Enum_StatusCodes
+ParseTilePropertyLine(const char *line, Struct_TilePropertyLoader *pLoader,
+                      Struct_StringPool *pString_pool,
+                      Struct_TilePropertyTable *pProperty_table) {
+  Enum_StatusCodes status = SUCCESS;
+  char *cursor = (char *)&line[2];
+  int64_t numbers[4];
+  uint32_t key, value;
+
+  if ((line[0] != 's' && line[0] != 'p') || line[1] != ' ') {
+    return FAILURE;
+  }
+
+  if (line[0] == 's') {
+    if (ParseLineNumber(&cursor, &numbers[0]) != SUCCESS || numbers[0] < 0 ||
+        numbers[0] >= UINT32_MAX) {
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, line, OUTPUT_LOG_STREAM);
+      return status;
+    }
+    if ((uint64_t)numbers[0] >= pLoader->capacity) {
+      uint64_t capacity = pLoader->capacity ? pLoader->capacity
+                                            : STRING_POOL_INITIAL_CAPACITY;
+      while (capacity <= (uint64_t)numbers[0]) {
+        capacity *= 2;
+      }
+      uint32_t *string_ids =
+          (capacity > UINT32_MAX)
+              ? NULL
+              : realloc(pLoader->string_ids, capacity * sizeof(uint32_t));
+      if (!string_ids) {
+        status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+        Logger(&status, NULL, "Error produced by ParseTilePropertyLine()",
+               OUTPUT_LOG_STREAM);
+        return status;
+      }
+      memset(&string_ids[pLoader->capacity], 0,
+             (capacity - pLoader->capacity) * sizeof(uint32_t));
+      pLoader->string_ids = string_ids;
+      pLoader->capacity = capacity;
+    }
+    if ((status = InternString(cursor, pString_pool, &key)) != SUCCESS) {
+      return status;
+    }
+    pLoader->string_ids[numbers[0]] = key + 1;
+    return status;
+  }
+
+  for (uint32_t i = 0; i < 4; i++) {
+    if (ParseLineNumber(&cursor, &numbers[i]) != SUCCESS) {
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, line, OUTPUT_LOG_STREAM);
+      return status;
+    }
+  }
+  if (numbers[0] < INT32_MIN || numbers[0] > INT32_MAX ||
+      numbers[1] < INT32_MIN || numbers[1] > INT32_MAX || numbers[2] < 0 ||
+      numbers[3] < 0 || LoadedStringId(numbers[2], pLoader, &key) != SUCCESS ||
+      LoadedStringId(numbers[3], pLoader, &value) != SUCCESS) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, line, OUTPUT_LOG_STREAM);
+    return status;
+  }
+
+  return SetTileProperty(numbers[0], numbers[1], key, value,
+                         pProperty_table);
+}
+
+Enum_StatusCodes DumpStringPoolBinary(const Struct_StringPool *pString_pool,
+                                      FILE *file) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t header[2] = {pString_pool->count,
+                        (uint32_t)pString_pool->chars_size};
+
+  if ((status = WriteBinary(header, sizeof(header), file)) != SUCCESS ||
+      (status = WriteBinary(pString_pool->chars, pString_pool->chars_size,
+                            file)) != SUCCESS) {
+    Logger(&status, NULL, "Error produced by DumpStringPoolBinary()",
+           OUTPUT_LOG_STREAM);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes LoadStringPoolBinary(const uint8_t **pCursor,
+                                      const uint8_t *end,
+                                      Struct_TilePropertyLoader *pLoader,
+                                      Struct_StringPool *pString_pool) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t header[2];
+  const void *chars_data;
+
+  // Every string takes at least its terminator.
+  if (ReadBinary(header, sizeof(header), pCursor, end) != SUCCESS ||
+      header[0] > header[1] ||
+      MapBinary(&chars_data, header[1], pCursor, end) != SUCCESS) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by LoadStringPoolBinary()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  const char *chars = chars_data;
+
+  FreeTilePropertyLoader(pLoader);
+  if (header[0] &&
+      !(pLoader->string_ids = malloc(header[0] * sizeof(uint32_t)))) {
+    status = MEM_ALLOC_FAILURE | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by LoadStringPoolBinary()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  pLoader->capacity = header[0];
+
+  size_t offset = 0;
+  for (uint32_t i = 0; i < header[0]; i++) {
+    const char *terminator = memchr(&chars[offset], '\0', header[1] - offset);
+    uint32_t id;
+    if (!terminator) {
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by LoadStringPoolBinary()",
+             OUTPUT_LOG_STREAM);
+      return status;
+    }
+    if ((status = InternString(&chars[offset], pString_pool, &id)) !=
+        SUCCESS) {
+      return status;
+    }
+    pLoader->string_ids[i] = id + 1;
+    offset = terminator - chars + 1;
+  }
+
+  return status;
+}
+
+Enum_StatusCodes
+DumpTilePropertiesBinary(const Struct_TilePropertyTable *pProperty_table,
+                         FILE *file) {
+  Enum_StatusCodes status = SUCCESS;
+
+  // Properties are plain words, the dense array is written as it is.
+  if ((status = WriteBinary(&pProperty_table->count, sizeof(uint32_t),
+                            file)) != SUCCESS ||
+      (status = WriteBinary(pProperty_table->properties,
+                            pProperty_table->count *
+                                sizeof(Struct_TileProperty),
+                            file)) != SUCCESS) {
+    Logger(&status, NULL, "Error produced by DumpTilePropertiesBinary()",
+           OUTPUT_LOG_STREAM);
+  }
+
+  return status;
+}
+
+Enum_StatusCodes
+LoadTilePropertiesBinary(const uint8_t **pCursor, const uint8_t *end,
+                         const Struct_TilePropertyLoader *pLoader,
+                         Struct_TilePropertyTable *pProperty_table) {
+  Enum_StatusCodes status = SUCCESS;
+  uint32_t count;
+  const void *data;
+
+  if (ReadBinary(&count, sizeof(count), pCursor, end) != SUCCESS ||
+      MapBinary(&data, (size_t)count * sizeof(Struct_TileProperty), pCursor,
+                end) != SUCCESS) {
+    status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+    Logger(&status, NULL, "Error produced by LoadTilePropertiesBinary()",
+           OUTPUT_LOG_STREAM);
+    return status;
+  }
+  const Struct_TileProperty *properties = data;
+
+  for (uint32_t i = 0; i < count && status == SUCCESS; i++) {
+    uint32_t key, value;
+    if (LoadedStringId(properties[i].key, pLoader, &key) != SUCCESS ||
+        LoadedStringId(properties[i].value, pLoader, &value) != SUCCESS) {
+      status = UNEXPECTED_COMPUTED_RESULTS | HIGH_SEVERITY_ERROR;
+      Logger(&status, NULL, "Error produced by LoadTilePropertiesBinary()",
+             OUTPUT_LOG_STREAM);
+      break;
+    }
+    status = SetTileProperty(properties[i].x, properties[i].y, key, value,
+                             pProperty_table);
+  }
+
+  return status;
+}
+
+void FreeTilePropertyLoader(Struct_TilePropertyLoader *pLoader) {
+  free(pLoader->string_ids);
+  *pLoader = (Struct_TilePropertyLoader){0};
+}
\ No newline at end of file